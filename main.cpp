@@ -4,19 +4,39 @@
 #include <vector>
 #include <cmath>
 #include <algorithm>
+#include <atomic>
+#include <thread>
+#include <cstring>
+#include <map>
+#include <unordered_map>
+#include <memory>
+#include <mutex>
+#include <limits>
+#include <type_traits>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSSE3__)
+#include <tmmintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 #include "stb_image.h"
 #include "stb_image_resize2.h"
 #include "stb_image_write.h"
 
 using std::cout;
 
-// WAV header structure
-struct WavHeader_t {
-    // RIFF chunk
+// WAV header structures (written as is, so no padding)
+#pragma pack(push, 1)
+struct RiffHeader_t {
     char riffId[4] = {'R', 'I', 'F', 'F'};
     uint32_t riffSize;
     char waveId[4] = {'W', 'A', 'V', 'E'};
-    // fmt chunk
+};
+
+// fmt chunk in its largest (WAVE_FORMAT_EXTENSIBLE) layout; only the first
+// 8 + fmtSize bytes get written, so plain PCM stops after bitsPerSample
+struct WavFmtChunk_t {
     char fmtId[4] = {'f', 'm', 't', ' '};
     uint32_t fmtSize = 16;
     uint16_t audioFormat = 1; // PCM
@@ -25,220 +45,2777 @@ struct WavHeader_t {
     uint32_t byteRate;        // SampleRate * NumChannels * BitsPerSample/8
     uint16_t blockAlign;      // NumChannels * BitsPerSample/8
     uint16_t bitsPerSample = 16;
-    // data chunk
-    char dataId[4] = {'d', 'a', 't', 'a'};
-    uint32_t dataSize;
+    uint16_t cbSize = 0;      // size of the extension below (fmtSize 18 or 40)
+    uint16_t validBitsPerSample = 0;
+    uint32_t channelMask = 0;
+    uint8_t subFormat[16] = {};
+};
+
+// generic chunk header (fact, data)
+struct WavChunkHeader_t {
+    char id[4];
+    uint32_t size;
+};
+#pragma pack(pop)
+
+enum class SampleFormat {
+    Int16,   // 16-bit PCM
+    Int24,   // packed 24-bit PCM (WAVE_FORMAT_EXTENSIBLE)
+    Float32  // IEEE float, written straight from the float pipeline
+};
+
+// set on ParallelFor worker threads, nested loops then just run inline
+static thread_local bool t_parallelWorker = false;
+
+// run fn(i) for every i in [0, count) spread over the available hardware threads
+template <typename Func>
+void ParallelFor(int count, Func fn)
+{
+    int threadCount = std::min<int>(count, std::max(1u, std::thread::hardware_concurrency()));
+    if (threadCount <= 1 || t_parallelWorker) {
+        for (int i = 0; i < count; ++i) fn(i);
+        return;
+    }
+
+    std::atomic<int> next(0);
+    std::vector<std::thread> workers;
+    for (int t = 0; t < threadCount; ++t) {
+        workers.emplace_back([&]() {
+            t_parallelWorker = true;
+            for (int i = next++; i < count; i = next++) fn(i);
+        });
+    }
+    for (auto& worker : workers) worker.join();
+}
+
+// an image held in memory, either decoded or already resized
+struct PixelBuffer_t {
+    int width = 0;
+    int height = 0;
+    int channels = 0;
+    std::vector<unsigned char> pixels;
+    std::vector<float> samples; // float resize output, used instead of pixels when present
+    bool linear = false;        // samples are linear light (sRGB decoded by the resize, or an HDR source)
+
+    const void* Data(void) const {return samples.empty() ? (const void*)pixels.data() : samples.data();}
+    stbir_datatype DataType(void) const {return samples.empty() ? STBIR_TYPE_UINT8 : STBIR_TYPE_FLOAT;}
+};
+
+enum class FrameInterpolation {
+    None,     // images shorter than the table are rejected
+    Linear,   // crossfade between neighbouring source rows
+    Spectral  // interpolate magnitude and phase of each harmonic
+};
+
+// part of the source image to use, in pixels; empty means all of it
+struct CropRect_t {
+    int x = 0;
+    int y = 0;
+    int width = 0;
+    int height = 0;
+    bool isolated = false; // resample as an image of its own, edges don't read the pixels around it
+    bool Empty(void) const {return width <= 0 || height <= 0;}
+};
+
+// how the image gets resampled to the table
+struct ResizeSettings_t {
+    FrameInterpolation interpolation = FrameInterpolation::None; // fills in frames for short images
+    bool wrapEdges = false; // treat rows as cyclic (STBIR_EDGE_WRAP); softens the seam, --loop-fade removes it
+    bool fixedPointLuma = false; // integer luma + lookup table instead of the float conversion
+    bool linearLight = false; // resize and weight the channels in linear light, not on the sRGB values
+    bool floatOutput = false; // resize straight to float instead of rounding to 8 bits (overrides fixedPointLuma)
+    CropRect_t crop;          // source region to resample, applies to the decoded image only
+};
+
+// one output table per mix of the image channels (--channels r,g,b or 0.5r+0.5a)
+struct ChannelMix_t {
+    std::string name;
+    float weights[4] = {0.0f, 0.0f, 0.0f, 0.0f}; // red, green, blue, alpha
+};
+
+// sRGB transfer curve as tables, so linear light processing needs no pow()
+// per pixel: decoding is a 256-entry lookup, encoding interpolates a 4096
+// segment table (within 2e-5 of the exact curve)
+struct SrgbTables_t {
+    float toLinear[256];
+    float toSrgb[4097];
+    SrgbTables_t()
+    {
+        for (int i = 0; i < 256; ++i) {
+            double c = i / 255.0;
+            toLinear[i] = (float)(c <= 0.04045 ? c / 12.92 : std::pow((c + 0.055) / 1.055, 2.4));
+        }
+        for (int i = 0; i <= 4096; ++i) {
+            double l = i / 4096.0;
+            toSrgb[i] = (float)(l <= 0.0031308 ? l * 12.92 : 1.055 * std::pow(l, 1.0 / 2.4) - 0.055);
+        }
+    }
+    // linear 0..1 to sRGB encoded 0..1
+    float Encode(float linear) const
+    {
+        float position = std::min(1.0f, std::max(0.0f, linear)) * 4096.0f;
+        int i = std::min((int)position, 4095);
+        return toSrgb[i] + (toSrgb[i + 1] - toSrgb[i]) * (position - i);
+    }
+};
+
+static const SrgbTables_t& SrgbTables(void)
+{
+    static const SrgbTables_t tables;
+    return tables;
+}
+
+// resize src into dst; dst.width and dst.height must be set to the target size
+// Alpha isn't used by the conversion, so 4-channel images are resized as
+// plain channels (STBIR_4CHANNEL) rather than STBIR_RGBA, which would run the
+// alpha weighting pass for nothing. Composite over a background at load
+// (LoadSettings_t) to have transparency show up in the table.
+static stbir_pixel_layout PixelLayout(int channels)
+{
+    return channels == 4 ? STBIR_4CHANNEL : (stbir_pixel_layout)channels;
+}
+
+// With floatOutput (always, for 16-bit and float sources) the result goes to
+// dst.samples as 0..1 floats, so the conversion reads the filter output at
+// full precision instead of a uint8 rounding of it. srcLinear marks source
+// data that is linear light already (HDR); the output is linear if that or
+// linearLight applies.
+bool ResizePixels(const void* src, stbir_datatype srcType, bool srcLinear, int srcWidth, int srcHeight, int channels,
+                  PixelBuffer_t& dst, const ResizeSettings_t& settings)
+{
+    // 8-bit data is filtered in linear light by having stbir decode it as sRGB
+    // (and encode the result back, for 8-bit output)
+    if (srcType == STBIR_TYPE_UINT8 && settings.linearLight && !srcLinear) srcType = STBIR_TYPE_UINT8_SRGB;
+    const bool highPrecision = srcType == STBIR_TYPE_UINT16 || srcType == STBIR_TYPE_FLOAT;
+    const stbir_datatype dstType = settings.floatOutput || highPrecision ? STBIR_TYPE_FLOAT : srcType;
+    const size_t valueCount = (size_t)dst.width * dst.height * channels;
+    void* out;
+    dst.channels = channels;
+    dst.linear = dstType == STBIR_TYPE_FLOAT && (srcLinear || srcType == STBIR_TYPE_UINT8_SRGB);
+    if (dstType == STBIR_TYPE_FLOAT) {
+        dst.pixels.clear();
+        dst.samples.resize(valueCount);
+        out = dst.samples.data();
+    } else {
+        dst.samples.clear();
+        dst.pixels.resize(valueCount);
+        out = dst.pixels.data();
+    }
+
+    // A crop is normally an input subrect: only the region (plus the filter
+    // taps at its border, which read the real neighbouring pixels) is
+    // resampled. Wrapping has to wrap within the crop, and isolated crops
+    // (animation frames) must not see their neighbours, so then the region is
+    // passed as an image of its own, through a pointer and the full row stride.
+    const CropRect_t& crop = settings.crop;
+    const bool cropByStride = !crop.Empty() && (settings.wrapEdges || crop.isolated);
+    int stride = 0;
+    if (cropByStride) {
+        const int valueBytes = srcType == STBIR_TYPE_FLOAT ? 4 : srcType == STBIR_TYPE_UINT16 ? 2 : 1;
+        stride = srcWidth * channels * valueBytes;
+        src = static_cast<const unsigned char*>(src) + (size_t)crop.y * stride + (size_t)crop.x * channels * valueBytes;
+        srcWidth = crop.width;
+        srcHeight = crop.height;
+    }
+
+    // same as stbir_resize_uint8_linear, but through the extended api so the edge modes can be set
+    STBIR_RESIZE resize;
+    stbir_resize_init(&resize,
+        src, srcWidth, srcHeight, stride,                 // source image, stride 0 = computed automatically
+        out, dst.width, dst.height, 0,                    // destination image
+        PixelLayout(channels), srcType);                  // number of channels
+    stbir_set_datatypes(&resize, srcType, dstType);
+    if (settings.wrapEdges) {
+        // the filter taps at the left/right edges read from the opposite side
+        stbir_set_edgemodes(&resize, STBIR_EDGE_WRAP, STBIR_EDGE_CLAMP);
+    }
+    if (!crop.Empty() && !cropByStride &&
+        !stbir_set_input_subrect(&resize, (double)crop.x / srcWidth, (double)crop.y / srcHeight,
+                                 (double)(crop.x + crop.width) / srcWidth, (double)(crop.y + crop.height) / srcHeight)) {
+        printf("Bad crop region\n");
+        return false;
+    }
+
+    if (!stbir_resize_extended(&resize)) {
+        printf("Resize operation failed\n");
+        return false;
+    }
+
+    printf("Image resized successfully to %d x %d\n", dst.width, dst.height);
+    return true;
+}
+
+// holds one decoded image in memory; processing is const so several
+// table geometries can be rendered from it (concurrently) without re-decoding
+class imageManager
+{
+    public:
+        imageManager() {}
+        ~imageManager()
+            {stbi_image_free(m_rawImageData);}
+        imageManager(const imageManager&) = delete;
+        imageManager& operator=(const imageManager&) = delete;
+        bool LoadFromFile(const std::string& imagePath, bool linearLight = false, bool allFrames = false);
+        std::vector<int> SelectFrames(int stepMs) const;
+        int CollapseFramesToRows(const std::vector<int>& frames);
+        void CompositeAlpha(const unsigned char background[3]);
+        void ConvertToLuma(bool linearLight = false);
+        int ResizedRows(int tableRows, const ResizeSettings_t& settings) const;
+        bool GetResizedData(int frameSize, int tableRows, const ResizeSettings_t& settings, PixelBuffer_t& resized) const;
+        std::vector<float> GetProcessedData(int frameSize, int tableRows, const ResizeSettings_t& settings = {}) const;
+        static std::vector<float> ConvertToWavetable(const PixelBuffer_t& resized, const ResizeSettings_t& settings = {});
+        int Width(void) const {return m_width;}
+        int Height(void) const {return m_height;}
+        int FrameHeight(void) const {return m_frameHeight;} // animation frames are stacked vertically
+        static std::vector<std::vector<float>> SplitChannels(const PixelBuffer_t& resized, const std::vector<ChannelMix_t>& mixes);
+
+    private:
+        void* m_rawImageData = nullptr;          // 8-bit, 16-bit or float, as decoded by stbi
+        std::vector<unsigned char> m_pixelData;  // 8-bit luma, composited image or GIF frame rows
+        std::vector<float> m_highPrecisionData;  // linearized 16-bit image, or the luma of a 16-bit/float one
+        const void* m_pixels = nullptr;          // the raw image or one of the planes above
+        stbir_datatype m_dataType = STBIR_TYPE_UINT8;
+        bool m_linear = false;                   // m_pixels holds linear light values
+        int m_height = 0;
+        int m_width = 0;
+        int m_channels = 0;
+        int m_frameHeight = 0;                   // == m_height unless all GIF frames were loaded
+        std::vector<int> m_frameDelays;          // milliseconds per GIF frame
+};
+
+// 16-bit PNGs and Radiance HDR files are kept at full precision instead of
+// being reduced to 8 bits by stbi_load. HDR data is linear light; 16-bit data
+// is linearized here (by table) when linearLight is requested, as stbir only
+// has an sRGB decode for 8-bit input. With allFrames an animated GIF is loaded
+// with all its frames, stacked top to bottom into one tall image, so a frame is
+// just a crop of it.
+bool imageManager::LoadFromFile(const std::string& imagePath, bool linearLight, bool allFrames)
+{
+    const char* path = imagePath.c_str();
+    std::vector<unsigned char> file;
+    if (allFrames) {
+        std::ifstream in(imagePath, std::ios::binary);
+        file.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    }
+    if (file.size() >= 6 && memcmp(file.data(), "GIF8", 4) == 0) {
+        int* delays = nullptr;
+        int frames = 0;
+        m_rawImageData = stbi_load_gif_from_memory(file.data(), (int)file.size(), &delays, &m_width, &m_frameHeight,
+                                                   &frames, &m_channels, 0);
+        if (m_rawImageData) {
+            m_height = m_frameHeight * frames;
+            m_frameDelays.assign(delays, delays + frames);
+            printf("Loaded %d GIF frames\n", frames);
+        }
+        stbi_image_free(delays);
+    } else if (stbi_is_hdr(path)) {
+        m_rawImageData = stbi_loadf(path, &m_width, &m_height, &m_channels, 0);
+        m_dataType = STBIR_TYPE_FLOAT;
+        m_linear = true;
+    } else if (stbi_is_16_bit(path)) {
+        m_rawImageData = stbi_load_16(path, &m_width, &m_height, &m_channels, 0);
+        m_dataType = STBIR_TYPE_UINT16;
+    } else {
+        m_rawImageData = stbi_load(path, &m_width, &m_height, &m_channels, 0);
+    }
+    if (!m_rawImageData) {
+        std::cerr << "Unknown error loading image: " << imagePath << std::endl;
+        return false;
+    }
+    m_pixels = m_rawImageData;
+    if (m_frameDelays.empty()) {
+        m_frameHeight = m_height;
+    }
+
+    if (m_dataType == STBIR_TYPE_UINT16 && linearLight) {
+        std::vector<float> toLinear(65536);
+        for (int i = 0; i < 65536; ++i) {
+            double c = i / 65535.0;
+            toLinear[i] = (float)(c <= 0.04045 ? c / 12.92 : std::pow((c + 0.055) / 1.055, 2.4));
+        }
+        const uint16_t* src = static_cast<const uint16_t*>(m_rawImageData);
+        const size_t valueCount = (size_t)m_width * m_height * m_channels;
+        const bool hasAlpha = m_channels == 2 || m_channels == 4;
+        m_highPrecisionData.resize(valueCount);
+        for (size_t i = 0; i < valueCount; ++i) {
+            bool alpha = hasAlpha && i % m_channels == (size_t)m_channels - 1;
+            m_highPrecisionData[i] = alpha ? src[i] / 65535.0f : toLinear[src[i]];
+        }
+        stbi_image_free(m_rawImageData);
+        m_rawImageData = nullptr;
+        m_pixels = m_highPrecisionData.data();
+        m_dataType = STBIR_TYPE_FLOAT;
+        m_linear = true;
+    }
+    if (m_dataType != STBIR_TYPE_UINT8) {
+        printf("Loaded %s image at full precision\n", m_linear ? "linear" : "16-bit");
+    }
+    return true;
+}
+
+// src over background for 8-bit RGBA, dropping alpha: (c*a + bg*(255-a)) / 255
+// rounded, with the division done as (t + (t >> 8)) >> 8 so the SSSE3 path
+// (4 pixels per step in 16-bit lanes) matches the scalar one exactly
+static void CompositeRgba8(const unsigned char* src, size_t pixelCount, const unsigned char background[3],
+                           unsigned char* dst)
+{
+    size_t i = 0;
+#if defined(__SSSE3__)
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i v255 = _mm_set1_epi16(255);
+    const __m128i v128 = _mm_set1_epi16(128);
+    const __m128i bg = _mm_setr_epi16(background[0], background[1], background[2], 0,
+                                      background[0], background[1], background[2], 0);
+    const __m128i alphaLow = _mm_setr_epi8(3, -1, 3, -1, 3, -1, 3, -1, 7, -1, 7, -1, 7, -1, 7, -1);
+    const __m128i alphaHigh = _mm_setr_epi8(11, -1, 11, -1, 11, -1, 11, -1, 15, -1, 15, -1, 15, -1, 15, -1);
+    const __m128i packMask = _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+    auto blend = [&](__m128i color, __m128i alpha) {
+        __m128i t = _mm_add_epi16(_mm_add_epi16(_mm_mullo_epi16(color, alpha),
+                                                _mm_mullo_epi16(bg, _mm_sub_epi16(v255, alpha))), v128);
+        return _mm_srli_epi16(_mm_add_epi16(t, _mm_srli_epi16(t, 8)), 8);
+    };
+    // the 16 byte store keeps 12, stop early enough that it never runs past dst
+    for (; i + 6 <= pixelCount; i += 4) {
+        __m128i px = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i * 4));
+        __m128i low = blend(_mm_unpacklo_epi8(px, zero), _mm_shuffle_epi8(px, alphaLow));
+        __m128i high = blend(_mm_unpackhi_epi8(px, zero), _mm_shuffle_epi8(px, alphaHigh));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i * 3), _mm_shuffle_epi8(_mm_packus_epi16(low, high), packMask));
+    }
+#endif
+    for (; i < pixelCount; ++i) {
+        unsigned int a = src[i * 4 + 3];
+        for (int c = 0; c < 3; ++c) {
+            unsigned int t = src[i * 4 + c] * a + background[c] * (255 - a) + 128;
+            dst[i * 3 + c] = (unsigned char)((t + (t >> 8)) >> 8);
+        }
+    }
+}
+
+// same for grey + alpha (against the background's luma) and for 16-bit / float
+// pixels, which composite in float; valueScale takes the colour channels to the
+// range of background and dst
+template <typename In, typename Out>
+static void CompositeGeneric(const In* src, size_t pixelCount, int channels, const float background[3],
+                             float valueScale, float alphaScale, Out* dst)
+{
+    const int colors = channels - 1;
+    const float grey = 0.2989f * background[0] + 0.587f * background[1] + 0.114f * background[2];
+    for (size_t i = 0; i < pixelCount; ++i) {
+        float a = src[i * channels + colors] * alphaScale;
+        for (int c = 0; c < colors; ++c) {
+            float bg = colors == 1 ? grey : background[c];
+            float v = src[i * channels + c] * valueScale * a + bg * (1.0f - a);
+            dst[i * colors + c] = std::is_integral<Out>::value ? (Out)(v + 0.5f) : (Out)v;
+        }
+    }
+}
+
+// grey and grey + alpha read as r = g = b, so alpha never enters the luma
+template <int Channels>
+static void LumaKernel(const unsigned char* src, size_t pixelCount, unsigned char* dst)
+{
+    for (size_t i = 0; i < pixelCount; ++i) {
+        float r = src[i * Channels];
+        float g = Channels > 2 ? src[i * Channels + 1] : r;
+        float b = Channels > 2 ? src[i * Channels + 2] : r;
+        dst[i] = (unsigned char)(0.2989f * r + 0.587f * g + 0.114f * b + 0.5f);
+    }
+}
+
+// linear light luma (Rec.709 weights on linearized channels), stored sRGB encoded
+template <int Channels>
+static void LinearLumaKernel(const unsigned char* src, size_t pixelCount, unsigned char* dst)
+{
+    const SrgbTables_t& srgb = SrgbTables();
+    for (size_t i = 0; i < pixelCount; ++i) {
+        float r = srgb.toLinear[src[i * Channels]];
+        float g = Channels > 2 ? srgb.toLinear[src[i * Channels + 1]] : r;
+        float b = Channels > 2 ? srgb.toLinear[src[i * Channels + 2]] : r;
+        dst[i] = (unsigned char)(srgb.Encode(0.2126f * r + 0.7152f * g + 0.0722f * b) * 255.0f + 0.5f);
+    }
+}
+
+// Frames to use from an animation: all of them, or with stepMs > 0 the frame
+// showing at every step through the animation's timeline (so frames are
+// repeated or skipped according to their delays).
+std::vector<int> imageManager::SelectFrames(int stepMs) const
+{
+    const int frameCount = m_frameHeight > 0 ? m_height / m_frameHeight : 0;
+    std::vector<int> frames;
+    int64_t duration = 0;
+    for (int delay : m_frameDelays) duration += std::max(delay, 0);
+    if (stepMs <= 0 || duration == 0) {
+        for (int frame = 0; frame < frameCount; ++frame) frames.push_back(frame);
+        return frames;
+    }
+    int frame = 0;
+    int64_t frameEnd = std::max(m_frameDelays[0], 0);
+    for (int64_t time = 0; time < duration; time += stepMs) {
+        while (time >= frameEnd && frame + 1 < frameCount) frameEnd += std::max(m_frameDelays[++frame], 0);
+        frames.push_back(frame);
+    }
+    return frames;
+}
+
+// Replaces the frame stack by one row per selected frame (the frame's column
+// averages), giving an image whose rows run through the animation in time.
+// Returns the number of rows, 0 (image untouched) unless an animation with
+// several frames was loaded.
+int imageManager::CollapseFramesToRows(const std::vector<int>& frames)
+{
+    if (!m_pixels || m_dataType != STBIR_TYPE_UINT8 || frames.empty() || m_frameDelays.size() < 2) return 0;
+
+    const int rowValues = m_width * m_channels;
+    const unsigned char* src = static_cast<const unsigned char*>(m_pixels);
+    std::vector<unsigned char> rows((size_t)frames.size() * rowValues);
+    ParallelFor((int)frames.size(), [&](int row) {
+        const unsigned char* frame = src + (size_t)frames[row] * m_frameHeight * rowValues;
+        std::vector<uint32_t> sums(rowValues, 0);
+        for (int y = 0; y < m_frameHeight; ++y) {
+            const unsigned char* line = frame + (size_t)y * rowValues;
+            for (int i = 0; i < rowValues; ++i) sums[i] += line[i];
+        }
+        for (int i = 0; i < rowValues; ++i) {
+            rows[(size_t)row * rowValues + i] = (unsigned char)((sums[i] + m_frameHeight / 2) / m_frameHeight);
+        }
+    });
+
+    m_pixelData.swap(rows);
+    stbi_image_free(m_rawImageData);
+    m_rawImageData = nullptr;
+    m_pixels = m_pixelData.data();
+    m_height = m_frameHeight = (int)frames.size();
+    m_frameDelays.clear();
+    printf("Collapsed %d frames into rows\n", m_height);
+    return m_height;
+}
+
+// Replaces the alpha channel by compositing over a solid background, leaving
+// 3 (RGBA) or 1 (grey + alpha) channels, so transparent areas get a defined
+// level and every later pass has one channel less to move.
+void imageManager::CompositeAlpha(const unsigned char background[3])
+{
+    if (!m_pixels || (m_channels != 2 && m_channels != 4)) return;
+
+    const size_t pixelCount = (size_t)m_width * m_height;
+    const int channels = m_channels - 1;
+    if (m_dataType == STBIR_TYPE_UINT8) {
+        std::vector<unsigned char> composited(pixelCount * channels);
+        const unsigned char* src = static_cast<const unsigned char*>(m_pixels);
+        if (m_channels == 4) {
+            CompositeRgba8(src, pixelCount, background, composited.data());
+        } else {
+            const float bg[3] = {(float)background[0], (float)background[1], (float)background[2]};
+            CompositeGeneric(src, pixelCount, m_channels, bg, 1.0f, 1.0f / 255.0f, composited.data());
+        }
+        m_pixelData.swap(composited);
+        m_pixels = m_pixelData.data();
+    } else {
+        std::vector<float> composited(pixelCount * channels);
+        if (m_dataType == STBIR_TYPE_UINT16) {
+            // into a float plane, 0..1 like the resize output
+            const float bg[3] = {background[0] / 255.0f, background[1] / 255.0f, background[2] / 255.0f};
+            CompositeGeneric(static_cast<const uint16_t*>(m_pixels), pixelCount, m_channels, bg,
+                             1.0f / 65535.0f, 1.0f / 65535.0f, composited.data());
+        } else {
+            const SrgbTables_t& srgb = SrgbTables();
+            float bg[3];
+            for (int c = 0; c < 3; ++c) bg[c] = m_linear ? srgb.toLinear[background[c]] : background[c] / 255.0f;
+            CompositeGeneric(static_cast<const float*>(m_pixels), pixelCount, m_channels, bg, 1.0f, 1.0f, composited.data());
+        }
+        m_highPrecisionData.swap(composited);
+        m_pixels = m_highPrecisionData.data();
+        m_dataType = STBIR_TYPE_FLOAT;
+    }
+    stbi_image_free(m_rawImageData);
+    m_rawImageData = nullptr;
+    m_channels = channels;
+    printf("Composited alpha over #%02x%02x%02x\n", background[0], background[1], background[2]);
+}
+
+// luma of 16-bit or float pixels as 0..1 floats; linear input gets the Rec.709
+// weights and stays linear
+template <int Channels, typename T>
+static void HighPrecisionLumaKernel(const T* src, size_t pixelCount, float scale, bool linear, float* dst)
+{
+    const float wr = linear ? 0.2126f : 0.2989f;
+    const float wg = linear ? 0.7152f : 0.587f;
+    const float wb = linear ? 0.0722f : 0.114f;
+    for (size_t i = 0; i < pixelCount; ++i) {
+        float r = src[i * Channels];
+        float g = Channels > 2 ? src[i * Channels + 1] : r;
+        float b = Channels > 2 ? src[i * Channels + 2] : r;
+        dst[i] = (wr * r + wg * g + wb * b) * scale;
+    }
+}
+
+template <typename T>
+static void HighPrecisionLuma(const T* src, int channels, size_t pixelCount, float scale, bool linear, float* dst)
+{
+    switch (channels) {
+        case 2: HighPrecisionLumaKernel<2>(src, pixelCount, scale, linear, dst); break;
+        case 3: HighPrecisionLumaKernel<3>(src, pixelCount, scale, linear, dst); break;
+        default: HighPrecisionLumaKernel<4>(src, pixelCount, scale, linear, dst); break;
+    }
+}
+
+// collapse the image to a single luma channel up front, so every later resize
+// only has to touch one byte per pixel instead of m_channels
+void imageManager::ConvertToLuma(bool linearLight)
+{
+    if (!m_pixels || m_channels == 1) return;
+
+    size_t pixelCount = (size_t)m_width * m_height;
+    if (m_dataType != STBIR_TYPE_UINT8) {
+        // 16-bit and float images keep a float luma plane
+        std::vector<float> luma(pixelCount);
+        if (m_dataType == STBIR_TYPE_UINT16) {
+            HighPrecisionLuma(static_cast<const uint16_t*>(m_pixels), m_channels, pixelCount, 1.0f / 65535.0f, false, luma.data());
+        } else {
+            HighPrecisionLuma(static_cast<const float*>(m_pixels), m_channels, pixelCount, 1.0f, m_linear, luma.data());
+        }
+        m_highPrecisionData.swap(luma);
+        stbi_image_free(m_rawImageData);
+        m_rawImageData = nullptr;
+        m_pixels = m_highPrecisionData.data();
+        m_dataType = STBIR_TYPE_FLOAT;
+        m_channels = 1;
+        printf("Converted image to luma\n");
+        return;
+    }
+
+    m_pixelData.resize(pixelCount);
+    const unsigned char* pixels = static_cast<const unsigned char*>(m_pixels);
+    if (linearLight) {
+        switch (m_channels) {
+            case 2: LinearLumaKernel<2>(pixels, pixelCount, m_pixelData.data()); break;
+            case 3: LinearLumaKernel<3>(pixels, pixelCount, m_pixelData.data()); break;
+            default: LinearLumaKernel<4>(pixels, pixelCount, m_pixelData.data()); break;
+        }
+    } else {
+        switch (m_channels) {
+            case 2: LumaKernel<2>(pixels, pixelCount, m_pixelData.data()); break;
+            case 3: LumaKernel<3>(pixels, pixelCount, m_pixelData.data()); break;
+            default: LumaKernel<4>(pixels, pixelCount, m_pixelData.data()); break;
+        }
+    }
+
+    stbi_image_free(m_rawImageData);
+    m_rawImageData = nullptr;
+    m_pixels = m_pixelData.data();
+    m_channels = 1;
+    printf("Converted image to luma\n");
+}
+
+// rows the image gets resized to; with frame interpolation a short image
+// keeps its own row count and the missing frames are generated later
+int imageManager::ResizedRows(int tableRows, const ResizeSettings_t& settings) const
+{
+    if (settings.interpolation != FrameInterpolation::None) {
+        return std::min(tableRows, settings.crop.Empty() ? m_height : settings.crop.height);
+    }
+    return tableRows;
+}
+
+bool imageManager::GetResizedData(int frameSize, int tableRows, const ResizeSettings_t& settings,
+                                  PixelBuffer_t& resized) const
+{
+    if (!m_pixels) {
+        std::cerr << "No image loaded" << std::endl;
+        return false;
+    }
+
+    const CropRect_t& crop = settings.crop;
+    if (!crop.Empty() && (crop.x < 0 || crop.y < 0 || crop.x + crop.width > m_width || crop.y + crop.height > m_height)) {
+        std::cerr << "Crop region " << crop.width << "x" << crop.height << "+" << crop.x << "+" << crop.y
+                  << " is outside the " << m_width << "x" << m_height << " image" << std::endl;
+        return false;
+    }
+    if ((crop.Empty() ? m_height : crop.height) < ResizedRows(tableRows, settings)) {
+        std::cerr << "Image not tall enough for requested rows\n" << std::endl;
+        return false;
+    }
+
+    // ----- Start by resizing the image to target wavetable size -----
+    resized.width = frameSize;
+    resized.height = ResizedRows(tableRows, settings);
+    return ResizePixels(m_pixels, m_dataType, m_linear, m_width, m_height, m_channels, resized, settings);
+}
+
+std::vector<float> imageManager::GetProcessedData(int frameSize, int tableRows, const ResizeSettings_t& settings) const
+{
+    PixelBuffer_t resized;
+    if (!GetResizedData(frameSize, tableRows, settings, resized)) {
+        return {};
+    }
+    return ConvertToWavetable(resized, settings);
+}
+
+// Grayscale + normalize for whole rows. Channels and
+// FrameSize are compile time constants for the common cases so the inner loop
+// has a fixed trip count and stride and gets fully unrolled/vectorized;
+// FrameSize == 0 is the generic path that takes the width at runtime. Like
+// SplitChannelRows, grey + alpha input reads as r = g = b and alpha is ignored.
+template <int Channels, int FrameSize>
+static void ConvertRowsKernel(const unsigned char* src, int runtimeFrameSize, int tableRows, float* dst)
+{
+    const int frameSize = FrameSize ? FrameSize : runtimeFrameSize;
+    for (int row = 0; row < tableRows; row++)
+    {
+        const unsigned char* in = src + (size_t)row * frameSize * Channels;
+        // write it out backwards (since Ableton starts at bottom)
+        float* out = dst + (size_t)(tableRows - 1 - row) * frameSize;
+        for (int i = 0; i < frameSize; ++i)
+        {
+            float r = in[i * Channels];
+            float g = Channels > 2 ? in[i * Channels + 1] : r;
+            float b = Channels > 2 ? in[i * Channels + 2] : r;
+            float grayscale = (0.2989f * r + 0.587f * g + 0.114f * b) / 255.0f;
+            // the grayscale values range from 0 to 1, we normalize this from -1 to 1 to create the wav
+            // (scaling to the output sample format happens when the file is written)
+            out[i] = grayscale * 2.0f - 1.0f;
+        }
+    }
+}
+
+// Fixed-point version of the conversion for 8-bit input: the luma weights
+// become 77/150/29 out of 256 (rounded), giving an 8-bit luma index, and a
+// 256-entry table maps that index straight to the output sample, folding in
+// the /255 and *2-1. Compared to the float path the weights differ by at most
+// 0.0019 and the index is rounded, so a sample is off by at most one luma step
+// (2/255 of full scale, 257 int16 steps); grey pixels come out within 0.03 of
+// a step. Scaling to the output sample format still happens when the file is
+// written, since dithering and the processing stages work on the float plane.
+// With AVX2 the luma plane (--luma-first) and RGB / RGBA pixels take a vector
+// path: 8 pixels at a time are widened to 16 bits, weighted with madd and
+// looked up with a gather; grey + alpha and the row tails stay scalar.
+struct LumaTable_t {
+    float values[256];
+    LumaTable_t()
+    {
+        for (int i = 0; i < 256; ++i) values[i] = (float)i / 255.0f * 2.0f - 1.0f;
+    }
+};
+
+template <int Channels, int FrameSize>
+static void ConvertRowsFixedKernel(const unsigned char* src, int runtimeFrameSize, int tableRows, float* dst)
+{
+    static const LumaTable_t table;
+    const int frameSize = FrameSize ? FrameSize : runtimeFrameSize;
+    for (int row = 0; row < tableRows; row++)
+    {
+        const unsigned char* in = src + (size_t)row * frameSize * Channels;
+        float* out = dst + (size_t)(tableRows - 1 - row) * frameSize;
+        int i = 0;
+#if defined(__AVX2__)
+        if (Channels == 1) {
+            // the luma plane is the index already, 8 table lookups per gather
+            for (; i + 8 <= frameSize; i += 8) {
+                __m128i bytes = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(in + i));
+                __m256i index = _mm256_cvtepu8_epi32(bytes);
+                _mm256_storeu_ps(out + i, _mm256_i32gather_ps(table.values, index, 4));
+            }
+        } else if (Channels == 3 || Channels == 4) {
+            // (77, 150, 29, 0) against each pixel's r, g, b, a/0 words
+            const __m256i weights = _mm256_set1_epi64x(0x0000001D0096004DLL);
+            const __m256i rounding = _mm256_set1_epi32(128);
+            // RGB: two overlapping 16 byte loads cover 8 pixels, spread to r, g, b, 0
+            const __m128i spreadLow = _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+            const __m128i spreadHigh = _mm_setr_epi8(4, 5, 6, -1, 7, 8, 9, -1, 10, 11, 12, -1, 13, 14, 15, -1);
+            for (; i + 8 <= frameSize; i += 8) {
+                const unsigned char* pixels = in + (size_t)i * Channels;
+                __m128i low = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pixels));
+                __m128i high = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pixels + (Channels == 4 ? 16 : 8)));
+                if (Channels == 3) {
+                    low = _mm_shuffle_epi8(low, spreadLow);
+                    high = _mm_shuffle_epi8(high, spreadHigh);
+                }
+                // pixels 0-1 | 2-3 and 4-5 | 6-7: 77r + 150g and 29b (+ 0a) per pixel
+                __m256i sumsLow = _mm256_madd_epi16(_mm256_cvtepu8_epi16(low), weights);
+                __m256i sumsHigh = _mm256_madd_epi16(_mm256_cvtepu8_epi16(high), weights);
+                // hadd gives pixels 0 1 4 5 | 2 3 6 7, the permute restores the order
+                __m256i luma = _mm256_permute4x64_epi64(_mm256_hadd_epi32(sumsLow, sumsHigh), _MM_SHUFFLE(3, 1, 2, 0));
+                __m256i index = _mm256_srli_epi32(_mm256_add_epi32(luma, rounding), 8);
+                _mm256_storeu_ps(out + i, _mm256_i32gather_ps(table.values, index, 4));
+            }
+        }
+#endif
+        for (; i < frameSize; ++i)
+        {
+            int r = in[i * Channels];
+            int g = Channels > 2 ? in[i * Channels + 1] : r;
+            int b = Channels > 2 ? in[i * Channels + 2] : r;
+            out[i] = table.values[(77 * r + 150 * g + 29 * b + 128) >> 8];
+        }
+    }
+}
+
+// Linear light conversion: the resized pixels are still sRGB encoded, they get
+// linearized by table, weighted with the Rec.709 luma coefficients (which are
+// meant for linear values) and the luma is encoded back to sRGB, so the
+// waveform follows perceived brightness like the plain path does.
+template <int Channels, int FrameSize>
+static void ConvertRowsLinearKernel(const unsigned char* src, int runtimeFrameSize, int tableRows, float* dst)
+{
+    static const LumaTable_t table;
+    const SrgbTables_t& srgb = SrgbTables();
+    const int frameSize = FrameSize ? FrameSize : runtimeFrameSize;
+    for (int row = 0; row < tableRows; row++)
+    {
+        const unsigned char* in = src + (size_t)row * frameSize * Channels;
+        float* out = dst + (size_t)(tableRows - 1 - row) * frameSize;
+        for (int i = 0; i < frameSize; ++i)
+        {
+            if (Channels == 1) {
+                // luma plane from ConvertToLuma, already encoded
+                out[i] = table.values[in[i]];
+                continue;
+            }
+            float r = srgb.toLinear[in[i * Channels]];
+            float g = Channels > 2 ? srgb.toLinear[in[i * Channels + 1]] : r;
+            float b = Channels > 2 ? srgb.toLinear[in[i * Channels + 2]] : r;
+            out[i] = srgb.Encode(0.2126f * r + 0.7152f * g + 0.0722f * b) * 2.0f - 1.0f;
+        }
+    }
+}
+
+template <int Channels>
+static void ConvertRows(const unsigned char* src, int frameSize, int tableRows, const ResizeSettings_t& settings, float* dst)
+{
+    if (settings.linearLight) {
+        switch (frameSize) {
+            case 256:  ConvertRowsLinearKernel<Channels, 256>(src, frameSize, tableRows, dst); break;
+            case 512:  ConvertRowsLinearKernel<Channels, 512>(src, frameSize, tableRows, dst); break;
+            case 1024: ConvertRowsLinearKernel<Channels, 1024>(src, frameSize, tableRows, dst); break;
+            case 2048: ConvertRowsLinearKernel<Channels, 2048>(src, frameSize, tableRows, dst); break;
+            default:   ConvertRowsLinearKernel<Channels, 0>(src, frameSize, tableRows, dst); break;
+        }
+        return;
+    }
+    if (settings.fixedPointLuma) {
+        switch (frameSize) {
+            case 256:  ConvertRowsFixedKernel<Channels, 256>(src, frameSize, tableRows, dst); break;
+            case 512:  ConvertRowsFixedKernel<Channels, 512>(src, frameSize, tableRows, dst); break;
+            case 1024: ConvertRowsFixedKernel<Channels, 1024>(src, frameSize, tableRows, dst); break;
+            case 2048: ConvertRowsFixedKernel<Channels, 2048>(src, frameSize, tableRows, dst); break;
+            default:   ConvertRowsFixedKernel<Channels, 0>(src, frameSize, tableRows, dst); break;
+        }
+        return;
+    }
+    switch (frameSize) {
+        case 256:  ConvertRowsKernel<Channels, 256>(src, frameSize, tableRows, dst); break;
+        case 512:  ConvertRowsKernel<Channels, 512>(src, frameSize, tableRows, dst); break;
+        case 1024: ConvertRowsKernel<Channels, 1024>(src, frameSize, tableRows, dst); break;
+        case 2048: ConvertRowsKernel<Channels, 2048>(src, frameSize, tableRows, dst); break;
+        default:   ConvertRowsKernel<Channels, 0>(src, frameSize, tableRows, dst); break;
+    }
+}
+
+// Same conversion for a float resize output: values are 0..1 already, and
+// linear light if the resize decoded sRGB or the source was linear (HDR), in
+// which case only the luma gets encoded back.
+template <int Channels, int FrameSize, bool LinearLight>
+static void ConvertFloatRowsKernel(const float* src, int runtimeFrameSize, int tableRows, float* dst)
+{
+    const SrgbTables_t& srgb = SrgbTables();
+    const int frameSize = FrameSize ? FrameSize : runtimeFrameSize;
+    for (int row = 0; row < tableRows; row++)
+    {
+        const float* in = src + (size_t)row * frameSize * Channels;
+        float* out = dst + (size_t)(tableRows - 1 - row) * frameSize;
+        for (int i = 0; i < frameSize; ++i)
+        {
+            float r = in[i * Channels];
+            float g = Channels > 2 ? in[i * Channels + 1] : r;
+            float b = Channels > 2 ? in[i * Channels + 2] : r;
+            if (LinearLight) {
+                float luma = Channels <= 2 ? r : 0.2126f * r + 0.7152f * g + 0.0722f * b;
+                out[i] = srgb.Encode(luma) * 2.0f - 1.0f;
+            } else {
+                out[i] = (0.2989f * r + 0.587f * g + 0.114f * b) * 2.0f - 1.0f;
+            }
+        }
+    }
+}
+
+template <int Channels, bool LinearLight>
+static void ConvertFloatRows(const float* src, int frameSize, int tableRows, float* dst)
+{
+    switch (frameSize) {
+        case 256:  ConvertFloatRowsKernel<Channels, 256, LinearLight>(src, frameSize, tableRows, dst); break;
+        case 512:  ConvertFloatRowsKernel<Channels, 512, LinearLight>(src, frameSize, tableRows, dst); break;
+        case 1024: ConvertFloatRowsKernel<Channels, 1024, LinearLight>(src, frameSize, tableRows, dst); break;
+        case 2048: ConvertFloatRowsKernel<Channels, 2048, LinearLight>(src, frameSize, tableRows, dst); break;
+        default:   ConvertFloatRowsKernel<Channels, 0, LinearLight>(src, frameSize, tableRows, dst); break;
+    }
+}
+
+template <int Channels>
+static void ConvertFloatRows(const float* src, int frameSize, int tableRows, bool linearLight, float* dst)
+{
+    if (linearLight) {
+        ConvertFloatRows<Channels, true>(src, frameSize, tableRows, dst);
+    } else {
+        ConvertFloatRows<Channels, false>(src, frameSize, tableRows, dst);
+    }
+}
+
+// turns a resized image (one pixel per sample) into wavetable rows in -1..1
+std::vector<float> imageManager::ConvertToWavetable(const PixelBuffer_t& resized, const ResizeSettings_t& settings)
+{
+    int frameSize = resized.width;
+    int tableRows = resized.height;
+    const unsigned char* src = resized.pixels.data();
+    std::vector<float> wavetableData((size_t)frameSize * tableRows);
+
+    if (!resized.samples.empty()) {
+        const float* values = resized.samples.data();
+        switch (resized.channels) {
+            case 1: ConvertFloatRows<1>(values, frameSize, tableRows, resized.linear, wavetableData.data()); break;
+            case 2: ConvertFloatRows<2>(values, frameSize, tableRows, resized.linear, wavetableData.data()); break;
+            case 3: ConvertFloatRows<3>(values, frameSize, tableRows, resized.linear, wavetableData.data()); break;
+            case 4: ConvertFloatRows<4>(values, frameSize, tableRows, resized.linear, wavetableData.data()); break;
+            default:
+                std::cerr << "Unsupported channel count: " << resized.channels << std::endl;
+                return {};
+        }
+        printf("Converted to wavetable\n");
+        return wavetableData;
+    }
+
+    switch (resized.channels) {
+        case 1: ConvertRows<1>(src, frameSize, tableRows, settings, wavetableData.data()); break;
+        case 2: ConvertRows<2>(src, frameSize, tableRows, settings, wavetableData.data()); break;
+        case 3: ConvertRows<3>(src, frameSize, tableRows, settings, wavetableData.data()); break;
+        case 4: ConvertRows<4>(src, frameSize, tableRows, settings, wavetableData.data()); break;
+        default:
+            std::cerr << "Unsupported channel count: " << resized.channels << std::endl;
+            return {};
+    }
+
+    printf("Converted to wavetable\n");
+
+    return wavetableData;
+}
+
+// Deinterleaves the resized image and mixes its channels into one table per
+// mix, in a single pass: each row is split into r/g/b/alpha scratch rows once
+// (while it's in cache) and every mix is then a weighted sum over those, a
+// loop the compiler vectorizes. Grey images read as r = g = b.
+template <int Channels, typename T>
+static void SplitChannelRows(const T* src, int frameSize, int tableRows, float scale, bool linear,
+                             const std::vector<ChannelMix_t>& mixes, std::vector<std::vector<float>>& planes)
+{
+    const SrgbTables_t& srgb = SrgbTables();
+    const int colors = Channels == 2 || Channels == 4 ? Channels - 1 : Channels;
+    ParallelFor(tableRows, [&](int row) {
+        std::vector<float> split((size_t)4 * frameSize, 0.0f);
+        float* channel[4] = {&split[0], &split[frameSize], &split[(size_t)2 * frameSize], &split[(size_t)3 * frameSize]};
+        const T* in = src + (size_t)row * frameSize * Channels;
+        for (int i = 0; i < frameSize; ++i) {
+            for (int c = 0; c < 3; ++c) channel[c][i] = in[i * Channels + std::min(c, colors - 1)] * scale;
+            if (colors < Channels) channel[3][i] = in[i * Channels + Channels - 1] * scale;
+        }
+        // write it out backwards like ConvertToWavetable
+        const size_t offset = (size_t)(tableRows - 1 - row) * frameSize;
+        for (size_t m = 0; m < mixes.size(); ++m) {
+            const float* w = mixes[m].weights;
+            float* out = &planes[m][offset];
+            for (int i = 0; i < frameSize; ++i) {
+                out[i] = w[0] * channel[0][i] + w[1] * channel[1][i] + w[2] * channel[2][i] + w[3] * channel[3][i];
+            }
+            for (int i = 0; i < frameSize; ++i) {
+                out[i] = (linear ? srgb.Encode(out[i]) : out[i]) * 2.0f - 1.0f;
+            }
+        }
+    });
+}
+
+template <typename T>
+static void SplitChannelRows(const T* src, int channels, int frameSize, int tableRows, float scale, bool linear,
+                             const std::vector<ChannelMix_t>& mixes, std::vector<std::vector<float>>& planes)
+{
+    switch (channels) {
+        case 1: SplitChannelRows<1>(src, frameSize, tableRows, scale, linear, mixes, planes); break;
+        case 2: SplitChannelRows<2>(src, frameSize, tableRows, scale, linear, mixes, planes); break;
+        case 3: SplitChannelRows<3>(src, frameSize, tableRows, scale, linear, mixes, planes); break;
+        default: SplitChannelRows<4>(src, frameSize, tableRows, scale, linear, mixes, planes); break;
+    }
+}
+
+std::vector<std::vector<float>> imageManager::SplitChannels(const PixelBuffer_t& resized, const std::vector<ChannelMix_t>& mixes)
+{
+    if (resized.channels < 1 || resized.channels > 4) {
+        std::cerr << "Unsupported channel count: " << resized.channels << std::endl;
+        return {};
+    }
+    bool hasAlpha = resized.channels == 2 || resized.channels == 4;
+    for (const ChannelMix_t& mix : mixes) {
+        if (mix.weights[3] != 0.0f && !hasAlpha) {
+            std::cerr << "Image has no alpha channel for " << mix.name << std::endl;
+            return {};
+        }
+    }
+
+    std::vector<std::vector<float>> planes(mixes.size(), std::vector<float>((size_t)resized.width * resized.height));
+    if (!resized.samples.empty()) {
+        SplitChannelRows(resized.samples.data(), resized.channels, resized.width, resized.height, 1.0f,
+                         resized.linear, mixes, planes);
+    } else {
+        SplitChannelRows(resized.pixels.data(), resized.channels, resized.width, resized.height, 1.0f / 255.0f,
+                         false, mixes, planes);
+    }
+    printf("Split into %d channel tables\n", (int)mixes.size());
+    return planes;
+}
+
+static int SampleFormatBytes(SampleFormat format)
+{
+    switch (format) {
+        case SampleFormat::Int24: return 3;
+        case SampleFormat::Float32: return 4;
+        default: return 2;
+    }
+}
+
+enum class DitherMode {
+    Truncate,    // plain truncation (the original behaviour)
+    Round,       // round to nearest
+    Tpdf,        // triangular dither, +-1 LSB
+    NoiseShaped  // TPDF with 2nd order error feedback, pushes the noise up in frequency
 };
 
-class imageManager
+struct DitherSettings_t {
+    DitherMode mode = DitherMode::Truncate;
+    uint32_t seed = 0;
+};
+
+// Counter based PRNG: the random value for a sample is a hash of its index
+// and the seed, so it's reproducible, needs no state between samples and
+// vectorizes (lowbias32 integer hash).
+static inline uint32_t HashCounter(uint32_t counter, uint32_t seedMix)
+{
+    uint32_t x = counter ^ seedMix;
+    x ^= x >> 16;
+    x *= 0x7feb352du;
+    x ^= x >> 15;
+    x *= 0x846ca68bu;
+    x ^= x >> 16;
+    return x;
+}
+
+// two 16-bit uniforms from one hash, their difference is triangular in -1..1
+static inline float TpdfFromHash(uint32_t hash)
+{
+    return (float)((int32_t)(hash & 0xFFFF) - (int32_t)(hash >> 16)) * (1.0f / 65536.0f);
+}
+
+#if defined(__AVX2__)
+static inline __m256i HashCounter8(__m256i counter, __m256i seedMix)
+{
+    __m256i x = _mm256_xor_si256(counter, seedMix);
+    x = _mm256_xor_si256(x, _mm256_srli_epi32(x, 16));
+    x = _mm256_mullo_epi32(x, _mm256_set1_epi32(0x7feb352d));
+    x = _mm256_xor_si256(x, _mm256_srli_epi32(x, 15));
+    x = _mm256_mullo_epi32(x, _mm256_set1_epi32((int)0x846ca68bu));
+    x = _mm256_xor_si256(x, _mm256_srli_epi32(x, 16));
+    return x;
+}
+#endif
+
+// Quantizes one block of float samples to integers in [-fullScale, fullScale].
+// counter is the index of the first sample, so results don't depend on how the
+// table was split into blocks. The AVX2 path performs the same float operations
+// in the same order as the scalar one, so both give identical output.
+template <DitherMode Mode>
+static void QuantizeBlock(const float* src, size_t count, float scale, float fullScale,
+                          uint32_t counter, uint32_t seedMix, int32_t* dst)
+{
+    size_t i = 0;
+#if defined(__AVX2__)
+    const __m256 vScale = _mm256_set1_ps(scale);
+    const __m256 vMax = _mm256_set1_ps(fullScale);
+    const __m256 vMin = _mm256_set1_ps(-fullScale);
+    const __m256 vHalf = _mm256_set1_ps(0.5f);
+    const __m256 vLsb = _mm256_set1_ps(1.0f / 65536.0f);
+    const __m256i vLow16 = _mm256_set1_epi32(0xFFFF);
+    const __m256i vSeedMix = _mm256_set1_epi32((int)seedMix);
+    const __m256i vLanes = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    for (; i + 8 <= count; i += 8) {
+        __m256 v = _mm256_mul_ps(_mm256_loadu_ps(src + i), vScale);
+        if (Mode == DitherMode::Tpdf) {
+            __m256i ctr = _mm256_add_epi32(_mm256_set1_epi32((int)(counter + (uint32_t)i)), vLanes);
+            __m256i hash = HashCounter8(ctr, vSeedMix);
+            __m256i diff = _mm256_sub_epi32(_mm256_and_si256(hash, vLow16), _mm256_srli_epi32(hash, 16));
+            v = _mm256_add_ps(v, _mm256_mul_ps(_mm256_cvtepi32_ps(diff), vLsb));
+        }
+        if (Mode != DitherMode::Truncate) {
+            v = _mm256_floor_ps(_mm256_add_ps(v, vHalf));
+        }
+        v = _mm256_min_ps(vMax, _mm256_max_ps(vMin, v));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), _mm256_cvttps_epi32(v));
+    }
+#endif
+    for (; i < count; ++i) {
+        float v = src[i] * scale;
+        if (Mode == DitherMode::Tpdf) {
+            v = v + TpdfFromHash(HashCounter(counter + (uint32_t)i, seedMix));
+        }
+        if (Mode != DitherMode::Truncate) {
+            v = std::floor(v + 0.5f);
+        }
+        v = std::min(fullScale, std::max(-fullScale, v));
+        dst[i] = static_cast<int32_t>(v);
+    }
+}
+
+// noise shaping feeds the quantization error back, so it can't be vectorized
+// along the block; blocks (rows) are still processed in parallel
+template <>
+void QuantizeBlock<DitherMode::NoiseShaped>(const float* src, size_t count, float scale, float fullScale,
+                                            uint32_t counter, uint32_t seedMix, int32_t* dst)
+{
+    float error1 = 0.0f, error2 = 0.0f;
+    for (size_t i = 0; i < count; ++i) {
+        // error filter (1 - z^-1)^2: the total error ends up highpassed
+        float shaped = src[i] * scale - 2.0f * error1 + error2;
+        float v = std::floor(shaped + TpdfFromHash(HashCounter(counter + (uint32_t)i, seedMix)) + 0.5f);
+        v = std::min(fullScale, std::max(-fullScale, v));
+        error2 = error1;
+        error1 = std::min(1.0f, std::max(-1.0f, v - shaped)); // keep clipping from running away
+        dst[i] = static_cast<int32_t>(v);
+    }
+}
+
+static void QuantizeBlock(DitherMode mode, const float* src, size_t count, float scale, float fullScale,
+                          uint32_t counter, uint32_t seedMix, int32_t* dst)
+{
+    switch (mode) {
+        case DitherMode::Truncate:    QuantizeBlock<DitherMode::Truncate>(src, count, scale, fullScale, counter, seedMix, dst); break;
+        case DitherMode::Round:       QuantizeBlock<DitherMode::Round>(src, count, scale, fullScale, counter, seedMix, dst); break;
+        case DitherMode::Tpdf:        QuantizeBlock<DitherMode::Tpdf>(src, count, scale, fullScale, counter, seedMix, dst); break;
+        case DitherMode::NoiseShaped: QuantizeBlock<DitherMode::NoiseShaped>(src, count, scale, fullScale, counter, seedMix, dst); break;
+    }
+}
+
+static void PackInt16(const int32_t* src, size_t count, int16_t* dst)
+{
+    for (size_t i = 0; i < count; ++i) {
+        dst[i] = static_cast<int16_t>(src[i]);
+    }
+}
+
+// 24-bit samples are packed little endian, 3 bytes each
+static void PackInt24(const int32_t* src, size_t count, unsigned char* dst)
+{
+    size_t i = 0;
+#if defined(__SSSE3__)
+    // shuffle away every 4th byte of 4 samples and store 16 bytes, of which 12
+    // are kept; stop early enough that the store never runs past dst
+    const __m128i packMask = _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+    for (; i + 6 <= count; i += 4) {
+        __m128i samples = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i * 3), _mm_shuffle_epi8(samples, packMask));
+    }
+#endif
+    for (; i < count; ++i) {
+        dst[i * 3] = (unsigned char)(src[i] & 0xFF);
+        dst[i * 3 + 1] = (unsigned char)((src[i] >> 8) & 0xFF);
+        dst[i * 3 + 2] = (unsigned char)((src[i] >> 16) & 0xFF);
+    }
+}
+
+// Interleaves length 32-bit values (floats or quantized ints) from each
+// channel's block. Stereo, the common case, goes through unpack instructions;
+// they only move bits, so ints are safe in float registers.
+template <typename T>
+static void InterleaveChannels(const std::vector<const T*>& planes, size_t length, T* dst)
+{
+    static_assert(sizeof(T) == 4, "32-bit samples only");
+    const size_t channels = planes.size();
+    size_t i = 0;
+    if (channels == 2) {
+        const float* left = reinterpret_cast<const float*>(planes[0]);
+        const float* right = reinterpret_cast<const float*>(planes[1]);
+        float* out = reinterpret_cast<float*>(dst);
+#if defined(__AVX2__)
+        for (; i + 8 <= length; i += 8) {
+            __m256 l = _mm256_loadu_ps(left + i);
+            __m256 r = _mm256_loadu_ps(right + i);
+            __m256 low = _mm256_unpacklo_ps(l, r);  // l0 r0 l1 r1 | l4 r4 l5 r5
+            __m256 high = _mm256_unpackhi_ps(l, r); // l2 r2 l3 r3 | l6 r6 l7 r7
+            _mm256_storeu_ps(out + 2 * i, _mm256_permute2f128_ps(low, high, 0x20));
+            _mm256_storeu_ps(out + 2 * i + 8, _mm256_permute2f128_ps(low, high, 0x31));
+        }
+#elif defined(__SSE2__)
+        for (; i + 4 <= length; i += 4) {
+            __m128 l = _mm_loadu_ps(left + i);
+            __m128 r = _mm_loadu_ps(right + i);
+            _mm_storeu_ps(out + 2 * i, _mm_unpacklo_ps(l, r));
+            _mm_storeu_ps(out + 2 * i + 4, _mm_unpackhi_ps(l, r));
+        }
+#endif
+    }
+    for (; i < length; ++i) {
+        for (size_t c = 0; c < channels; ++c) dst[i * channels + c] = planes[c][i];
+    }
+}
+
+// float -1..1 samples, one plane of count samples per channel, to the
+// interleaved little endian bytes of the output format. Works a block
+// (normally one table row) at a time, blocks run in parallel. Each channel is
+// quantized on its own (own dither sequence and noise shaping state) and the
+// integers are interleaved while packing, so no per-channel copy of the table
+// is made.
+static void QuantizeSamples(const std::vector<const float*>& planes, size_t count, size_t blockSize, float gain,
+                            SampleFormat format, const DitherSettings_t& dither, unsigned char* dst)
+{
+    const size_t channels = planes.size();
+    const float fullScale = format == SampleFormat::Int24 ? 8388607.0f : 32767.0f;
+    const int blockCount = (int)((count + blockSize - 1) / blockSize);
+    ParallelFor(blockCount, [&](int block) {
+        size_t start = (size_t)block * blockSize;
+        size_t length = std::min(blockSize, count - start);
+        std::vector<const float*> blocks(channels);
+        for (size_t c = 0; c < channels; ++c) blocks[c] = planes[c] + start;
+        if (format == SampleFormat::Float32) {
+            float* out = reinterpret_cast<float*>(dst) + start * channels;
+            InterleaveChannels(blocks, length, out);
+            for (size_t i = 0; i < length * channels; ++i) out[i] *= gain;
+            return;
+        }
+
+        std::vector<int32_t> quantized(length * channels);
+        std::vector<const int32_t*> quantizedPlanes(channels);
+        for (size_t c = 0; c < channels; ++c) {
+            const uint32_t seedMix = HashCounter(dither.seed, 0x9E3779B9u + (uint32_t)c);
+            QuantizeBlock(dither.mode, blocks[c], length, gain * fullScale, fullScale,
+                          (uint32_t)start, seedMix, &quantized[c * length]);
+            quantizedPlanes[c] = &quantized[c * length];
+        }
+        const int32_t* packed = quantized.data();
+        std::vector<int32_t> interleaved;
+        if (channels > 1) {
+            interleaved.resize(length * channels);
+            InterleaveChannels(quantizedPlanes, length, interleaved.data());
+            packed = interleaved.data();
+        }
+        if (format == SampleFormat::Int24) {
+            PackInt24(packed, length * channels, dst + start * channels * 3);
+        } else {
+            PackInt16(packed, length * channels, reinterpret_cast<int16_t*>(dst) + start * channels);
+        }
+    });
+}
+
+// Real FFT for one frame size, plans are built once per size and cached.
+// Power of two sizes run an N/2 point complex FFT (Stockham autosort, radix-4
+// stages plus one radix-2 stage for odd log2) on split re/im arrays, followed
+// by the usual real-input split step. Other sizes fall back to a direct DFT
+// from a precomputed table, which is slow but keeps odd frame sizes working.
+// Spectra are Bins() = N/2 + 1 complex values, unnormalized; Inverse scales by
+// 1/N so Inverse(Forward(x)) == x.
+class FftPlan
+{
+    public:
+        explicit FftPlan(int size);
+        static const FftPlan& Get(int size);
+        int Size(void) const {return m_size;}
+        int Bins(void) const {return m_size / 2 + 1;}
+        void Forward(const float* input, float* re, float* im) const;
+        void Inverse(const float* re, const float* im, float* output) const;
+        // batched over rows of Size() samples / Bins() bins, rows run in parallel
+        void ForwardRows(const float* input, int rows, float* re, float* im) const;
+        void InverseRows(const float* re, const float* im, int rows, float* output) const;
+
+    private:
+        struct Stage_t {
+            int radix;
+            int m;       // butterflies per group
+            int stride;  // s, distance between elements of one butterfly's input
+            std::vector<float> w1r, w1i, w2r, w2i, w3r, w3i;
+        };
+        void ComplexForward(float* re, float* im, float* workRe, float* workIm) const;
+        void DirectForward(const float* input, float* re, float* im) const;
+        void DirectInverse(const float* re, const float* im, float* output) const;
+
+        int m_size;
+        int m_half;          // complex FFT size for the power of two path
+        bool m_powerOfTwo;
+        std::vector<Stage_t> m_stages;
+        std::vector<float> m_splitRe, m_splitIm; // W_N^k for the real split step
+        std::vector<float> m_cos, m_sin;         // DFT table for the generic path
+};
+
+FftPlan::FftPlan(int size)
+    : m_size(size), m_half(size / 2), m_powerOfTwo(size >= 2 && (size & (size - 1)) == 0)
+{
+    const double twoPi = 6.283185307179586;
+    if (!m_powerOfTwo) {
+        m_cos.resize(size);
+        m_sin.resize(size);
+        for (int k = 0; k < size; ++k) {
+            m_cos[k] = (float)cos(twoPi * k / size);
+            m_sin[k] = (float)sin(twoPi * k / size);
+        }
+        return;
+    }
+
+    int n = m_half;
+    int stride = 1;
+    while (n > 1) {
+        Stage_t stage;
+        stage.radix = (n % 4 == 0) ? 4 : 2;
+        stage.m = n / stage.radix;
+        stage.stride = stride;
+        for (int p = 0; p < stage.m; ++p) {
+            double angle = -twoPi * p / n;
+            stage.w1r.push_back((float)cos(angle));
+            stage.w1i.push_back((float)sin(angle));
+            stage.w2r.push_back((float)cos(2 * angle));
+            stage.w2i.push_back((float)sin(2 * angle));
+            stage.w3r.push_back((float)cos(3 * angle));
+            stage.w3i.push_back((float)sin(3 * angle));
+        }
+        m_stages.push_back(std::move(stage));
+        n /= m_stages.back().radix;
+        stride *= m_stages.back().radix;
+    }
+
+    for (int k = 0; k <= m_half; ++k) {
+        m_splitRe.push_back((float)cos(-twoPi * k / size));
+        m_splitIm.push_back((float)sin(-twoPi * k / size));
+    }
+}
+
+const FftPlan& FftPlan::Get(int size)
+{
+    static std::mutex cacheMutex;
+    static std::map<int, std::unique_ptr<FftPlan>> cache;
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    auto& plan = cache[size];
+    if (!plan) plan.reset(new FftPlan(size));
+    return *plan;
+}
+
+// in place forward complex FFT of m_half points; work buffers are the same size
+void FftPlan::ComplexForward(float* re, float* im, float* workRe, float* workIm) const
+{
+    float *xr = re, *xi = im, *yr = workRe, *yi = workIm;
+    for (const Stage_t& stage : m_stages) {
+        const int m = stage.m;
+        const int s = stage.stride;
+        for (int p = 0; p < m; ++p) {
+            if (stage.radix == 2) {
+                const float wr = stage.w1r[p], wi = stage.w1i[p];
+                for (int q = 0; q < s; ++q) {
+                    float ar = xr[q + s * p], ai = xi[q + s * p];
+                    float br = xr[q + s * (p + m)], bi = xi[q + s * (p + m)];
+                    yr[q + s * (2 * p)] = ar + br;
+                    yi[q + s * (2 * p)] = ai + bi;
+                    float dr = ar - br, di = ai - bi;
+                    yr[q + s * (2 * p + 1)] = dr * wr - di * wi;
+                    yi[q + s * (2 * p + 1)] = dr * wi + di * wr;
+                }
+                continue;
+            }
+
+            const float w1r = stage.w1r[p], w1i = stage.w1i[p];
+            const float w2r = stage.w2r[p], w2i = stage.w2i[p];
+            const float w3r = stage.w3r[p], w3i = stage.w3i[p];
+            const float *ar = xr + s * p, *ai = xi + s * p;
+            const float *br = xr + s * (p + m), *bi = xi + s * (p + m);
+            const float *cr = xr + s * (p + 2 * m), *ci = xi + s * (p + 2 * m);
+            const float *dr = xr + s * (p + 3 * m), *di = xi + s * (p + 3 * m);
+            float *y0r = yr + s * (4 * p), *y0i = yi + s * (4 * p);
+            float *y1r = y0r + s, *y1i = y0i + s;
+            float *y2r = y1r + s, *y2i = y1i + s;
+            float *y3r = y2r + s, *y3i = y2i + s;
+            int q = 0;
+#if defined(__SSE2__)
+            // later stages have s a multiple of 4: four butterflies per iteration
+            const __m128 vw1r = _mm_set1_ps(w1r), vw1i = _mm_set1_ps(w1i);
+            const __m128 vw2r = _mm_set1_ps(w2r), vw2i = _mm_set1_ps(w2i);
+            const __m128 vw3r = _mm_set1_ps(w3r), vw3i = _mm_set1_ps(w3i);
+            for (; q + 4 <= s; q += 4) {
+                __m128 var = _mm_loadu_ps(ar + q), vai = _mm_loadu_ps(ai + q);
+                __m128 vbr = _mm_loadu_ps(br + q), vbi = _mm_loadu_ps(bi + q);
+                __m128 vcr = _mm_loadu_ps(cr + q), vci = _mm_loadu_ps(ci + q);
+                __m128 vdr = _mm_loadu_ps(dr + q), vdi = _mm_loadu_ps(di + q);
+                __m128 apcR = _mm_add_ps(var, vcr), apcI = _mm_add_ps(vai, vci);
+                __m128 amcR = _mm_sub_ps(var, vcr), amcI = _mm_sub_ps(vai, vci);
+                __m128 bpdR = _mm_add_ps(vbr, vdr), bpdI = _mm_add_ps(vbi, vdi);
+                // j * (b - d)
+                __m128 jbmdR = _mm_sub_ps(vdi, vbi), jbmdI = _mm_sub_ps(vbr, vdr);
+                _mm_storeu_ps(y0r + q, _mm_add_ps(apcR, bpdR));
+                _mm_storeu_ps(y0i + q, _mm_add_ps(apcI, bpdI));
+                __m128 t1r = _mm_sub_ps(amcR, jbmdR), t1i = _mm_sub_ps(amcI, jbmdI);
+                __m128 t2r = _mm_sub_ps(apcR, bpdR), t2i = _mm_sub_ps(apcI, bpdI);
+                __m128 t3r = _mm_add_ps(amcR, jbmdR), t3i = _mm_add_ps(amcI, jbmdI);
+                _mm_storeu_ps(y1r + q, _mm_sub_ps(_mm_mul_ps(t1r, vw1r), _mm_mul_ps(t1i, vw1i)));
+                _mm_storeu_ps(y1i + q, _mm_add_ps(_mm_mul_ps(t1r, vw1i), _mm_mul_ps(t1i, vw1r)));
+                _mm_storeu_ps(y2r + q, _mm_sub_ps(_mm_mul_ps(t2r, vw2r), _mm_mul_ps(t2i, vw2i)));
+                _mm_storeu_ps(y2i + q, _mm_add_ps(_mm_mul_ps(t2r, vw2i), _mm_mul_ps(t2i, vw2r)));
+                _mm_storeu_ps(y3r + q, _mm_sub_ps(_mm_mul_ps(t3r, vw3r), _mm_mul_ps(t3i, vw3i)));
+                _mm_storeu_ps(y3i + q, _mm_add_ps(_mm_mul_ps(t3r, vw3i), _mm_mul_ps(t3i, vw3r)));
+            }
+#endif
+            for (; q < s; ++q) {
+                float apcR = ar[q] + cr[q], apcI = ai[q] + ci[q];
+                float amcR = ar[q] - cr[q], amcI = ai[q] - ci[q];
+                float bpdR = br[q] + dr[q], bpdI = bi[q] + di[q];
+                float jbmdR = di[q] - bi[q], jbmdI = br[q] - dr[q];
+                y0r[q] = apcR + bpdR;
+                y0i[q] = apcI + bpdI;
+                float t1r = amcR - jbmdR, t1i = amcI - jbmdI;
+                float t2r = apcR - bpdR, t2i = apcI - bpdI;
+                float t3r = amcR + jbmdR, t3i = amcI + jbmdI;
+                y1r[q] = t1r * w1r - t1i * w1i;
+                y1i[q] = t1r * w1i + t1i * w1r;
+                y2r[q] = t2r * w2r - t2i * w2i;
+                y2i[q] = t2r * w2i + t2i * w2r;
+                y3r[q] = t3r * w3r - t3i * w3i;
+                y3i[q] = t3r * w3i + t3i * w3r;
+            }
+        }
+        std::swap(xr, yr);
+        std::swap(xi, yi);
+    }
+
+    // result ended up in the work buffers after an odd number of stages
+    if (xr != re) {
+        std::copy(xr, xr + m_half, re);
+        std::copy(xi, xi + m_half, im);
+    }
+}
+
+void FftPlan::Forward(const float* input, float* re, float* im) const
+{
+    if (!m_powerOfTwo) {
+        DirectForward(input, re, im);
+        return;
+    }
+
+    // pack even/odd samples as one half size complex signal
+    thread_local std::vector<float> scratch;
+    scratch.resize(4 * (size_t)m_half);
+    float* zr = scratch.data();
+    float* zi = zr + m_half;
+    for (int k = 0; k < m_half; ++k) {
+        zr[k] = input[2 * k];
+        zi[k] = input[2 * k + 1];
+    }
+    ComplexForward(zr, zi, zi + m_half, zi + 2 * m_half);
+
+    // split: X[k] = E[k] + W^k O[k], E/O being the spectra of the even/odd samples
+    for (int k = 0; k <= m_half; ++k) {
+        int a = k % m_half, b = (m_half - k) % m_half;
+        float evenR = 0.5f * (zr[a] + zr[b]), evenI = 0.5f * (zi[a] - zi[b]);
+        float oddR = 0.5f * (zi[a] + zi[b]), oddI = -0.5f * (zr[a] - zr[b]);
+        re[k] = evenR + m_splitRe[k] * oddR - m_splitIm[k] * oddI;
+        im[k] = evenI + m_splitRe[k] * oddI + m_splitIm[k] * oddR;
+    }
+}
+
+void FftPlan::Inverse(const float* re, const float* im, float* output) const
+{
+    if (!m_powerOfTwo) {
+        DirectInverse(re, im, output);
+        return;
+    }
+
+    thread_local std::vector<float> scratch;
+    scratch.resize(4 * (size_t)m_half);
+    float* zr = scratch.data();
+    float* zi = zr + m_half;
+    // undo the split step, building the conjugate of Z so a forward FFT inverts it
+    // the DC and Nyquist bins of a real signal are real, so their imaginary parts are ignored as in DirectInverse
+    for (int k = 0; k < m_half; ++k) {
+        int b = m_half - k;
+        float imK = k ? im[k] : 0.0f, imB = k ? im[b] : 0.0f;
+        float evenR = 0.5f * (re[k] + re[b]), evenI = 0.5f * (imK - imB);
+        float diffR = 0.5f * (re[k] - re[b]), diffI = 0.5f * (imK + imB);
+        // O[k] = (X[k] - conj(X[N/2-k])) / 2 * conj(W^k)
+        float oddR = diffR * m_splitRe[k] + diffI * m_splitIm[k];
+        float oddI = diffI * m_splitRe[k] - diffR * m_splitIm[k];
+        // Z = E + jO, conjugated
+        zr[k] = evenR - oddI;
+        zi[k] = -(evenI + oddR);
+    }
+    ComplexForward(zr, zi, zi + m_half, zi + 2 * m_half);
+
+    const float scale = 1.0f / m_half;
+    for (int k = 0; k < m_half; ++k) {
+        output[2 * k] = zr[k] * scale;
+        output[2 * k + 1] = -zi[k] * scale;
+    }
+}
+
+void FftPlan::DirectForward(const float* input, float* re, float* im) const
+{
+    for (int k = 0; k < Bins(); ++k) {
+        double sumR = 0.0, sumI = 0.0;
+        size_t index = 0;
+        for (int n = 0; n < m_size; ++n) {
+            sumR += input[n] * m_cos[index];
+            sumI -= input[n] * m_sin[index];
+            index += k;
+            if (index >= (size_t)m_size) index -= m_size;
+        }
+        re[k] = (float)sumR;
+        im[k] = (float)sumI;
+    }
+}
+
+void FftPlan::DirectInverse(const float* re, const float* im, float* output) const
+{
+    // hermitian symmetry: the upper half of the spectrum mirrors the lower
+    for (int n = 0; n < m_size; ++n) {
+        double sum = re[0];
+        size_t index = n;
+        for (int k = 1; k < Bins(); ++k) {
+            double weight = (2 * k == m_size) ? 1.0 : 2.0;
+            sum += weight * (re[k] * m_cos[index] - im[k] * m_sin[index]);
+            index += n;
+            if (index >= (size_t)m_size) index -= m_size;
+        }
+        output[n] = (float)(sum / m_size);
+    }
+}
+
+void FftPlan::ForwardRows(const float* input, int rows, float* re, float* im) const
+{
+    ParallelFor(rows, [&](int row) {
+        Forward(input + (size_t)row * m_size, re + (size_t)row * Bins(), im + (size_t)row * Bins());
+    });
+}
+
+void FftPlan::InverseRows(const float* re, const float* im, int rows, float* output) const
+{
+    ParallelFor(rows, [&](int row) {
+        Inverse(re + (size_t)row * Bins(), im + (size_t)row * Bins(), output + (size_t)row * m_size);
+    });
+}
+
+enum class SpectralPhase {
+    Zero,      // all harmonics in cosine phase (peaky, buzzy)
+    Schroeder, // Schroeder phases, low crest factor
+    Random     // seeded random phase per harmonic
+};
+
+// spectral mode: rows are read as harmonic magnitude spectra instead of waveforms
+struct SpectralSettings_t {
+    bool enabled = false;
+    SpectralPhase phase = SpectralPhase::Schroeder;
+    uint32_t seed = 0;
+};
+
+enum class AlignMode {
+    None,
+    CrossCorrelation, // rotate each frame to best match the (aligned) frame before it
+    ZeroCrossing      // rotate each frame to start on a rising zero crossing
+};
+
+enum class DcMode {
+    None,
+    Frame, // remove each frame's own mean
+    Table  // remove the mean of the whole table
+};
+
+enum class NormalizeMode {
+    None,
+    PeakFrame,
+    PeakTable,
+    RmsFrame,
+    RmsTable
+};
+
+struct LevelSettings_t {
+    DcMode dc = DcMode::None;
+    NormalizeMode normalize = NormalizeMode::None;
+    float target = 0.0f; // peak or RMS to normalize to, 0 = 1.0 for peak / 0.25 for RMS
+};
+
+// dot product of two frames, 4 independent accumulators to hide the add latency
+static float DotProduct(const float* a, const float* b, int count)
+{
+    int i = 0;
+#if defined(__AVX2__)
+    __m256 acc0 = _mm256_setzero_ps(), acc1 = _mm256_setzero_ps();
+    __m256 acc2 = _mm256_setzero_ps(), acc3 = _mm256_setzero_ps();
+    for (; i + 32 <= count; i += 32) {
+        acc0 = _mm256_add_ps(acc0, _mm256_mul_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i)));
+        acc1 = _mm256_add_ps(acc1, _mm256_mul_ps(_mm256_loadu_ps(a + i + 8), _mm256_loadu_ps(b + i + 8)));
+        acc2 = _mm256_add_ps(acc2, _mm256_mul_ps(_mm256_loadu_ps(a + i + 16), _mm256_loadu_ps(b + i + 16)));
+        acc3 = _mm256_add_ps(acc3, _mm256_mul_ps(_mm256_loadu_ps(a + i + 24), _mm256_loadu_ps(b + i + 24)));
+    }
+    __m256 acc = _mm256_add_ps(_mm256_add_ps(acc0, acc1), _mm256_add_ps(acc2, acc3));
+    __m128 half = _mm_add_ps(_mm256_castps256_ps128(acc), _mm256_extractf128_ps(acc, 1));
+#elif defined(__SSE2__)
+    __m128 acc0 = _mm_setzero_ps(), acc1 = _mm_setzero_ps();
+    __m128 acc2 = _mm_setzero_ps(), acc3 = _mm_setzero_ps();
+    for (; i + 16 <= count; i += 16) {
+        acc0 = _mm_add_ps(acc0, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+        acc1 = _mm_add_ps(acc1, _mm_mul_ps(_mm_loadu_ps(a + i + 4), _mm_loadu_ps(b + i + 4)));
+        acc2 = _mm_add_ps(acc2, _mm_mul_ps(_mm_loadu_ps(a + i + 8), _mm_loadu_ps(b + i + 8)));
+        acc3 = _mm_add_ps(acc3, _mm_mul_ps(_mm_loadu_ps(a + i + 12), _mm_loadu_ps(b + i + 12)));
+    }
+    __m128 half = _mm_add_ps(_mm_add_ps(acc0, acc1), _mm_add_ps(acc2, acc3));
+#endif
+    float sum = 0.0f;
+#if defined(__AVX2__) || defined(__SSE2__)
+    float lanes[4];
+    _mm_storeu_ps(lanes, half);
+    sum = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+#endif
+    for (; i < count; ++i) {
+        sum += a[i] * b[i];
+    }
+    return sum;
+}
+
+class ImageSession;
+
+class WaveTableWriter
+{
+    public:
+        WaveTableWriter(int frameSize = 1024, int tableRows = 256)
+            : m_frameSize(frameSize), m_tableRows(tableRows) {}
+        ~WaveTableWriter() {}        
+        bool GetDataFromImageFile(const std::string& imagePath);
+        bool GetDataFromSession(const ImageSession& session, const ResizeSettings_t& settings = {});
+        bool GetDataFromPixels(const PixelBuffer_t& resized, const ResizeSettings_t& settings = {});
+        bool GetDataFromPlane(std::vector<float>&& plane, const ResizeSettings_t& settings = {});
+        bool WriteWaveTableToFile(const std::string& filename, bool invert) const;
+        static bool WriteMultiChannelFile(const std::vector<WaveTableWriter>& channels, const std::string& filename, bool invert);
+        int TrimData(uint16_t thresholdVariance);
+        static int TrimLinked(std::vector<WaveTableWriter>& channels, uint16_t thresholdVariance);
+        void PrintRowMinMax(void);
+        bool DataReady(void) const {return m_dataReady;}
+        void SetSampleFormat(SampleFormat format) {m_sampleFormat = format;}
+        void SetDither(const DitherSettings_t& dither) {m_dither = dither;}
+        bool GetSpectra(std::vector<float>& re, std::vector<float>& im) const;
+        std::vector<WaveTableWriter> BuildMipmaps(int octaves) const;
+        bool SynthesizeFromSpectra(const SpectralSettings_t& settings);
+        bool AlignFrames(AlignMode mode);
+        static bool AlignLinked(std::vector<WaveTableWriter>& channels, AlignMode mode);
+        bool ConditionLevels(const LevelSettings_t& settings);
+        bool CrossfadeLoopEdges(int fadeLength);
+        bool InterpolateFrames(FrameInterpolation mode);
+        bool ReorderFrames(void);
+        int ReduceFrames(int targetFrames, uint32_t seed);
+        int RemoveDuplicateFrames(int tolerance, uint32_t seed, std::vector<int>& collapsed);
+    private:
+        int RowCount(void) const {return (int)(m_wavData.size() / m_frameSize);}
+        std::vector<int> FrameShifts(AlignMode mode) const;
+        void ShiftFrames(const std::vector<int>& shifts);
+        int m_frameSize;
+        int m_tableRows;
+        std::vector<float> m_wavData; // samples in -1..1, quantized when written
+        SampleFormat m_sampleFormat = SampleFormat::Int16;
+        DitherSettings_t m_dither;
+        bool m_dataReady = false;
+};
+
+// one parameter set to render from an ImageSession
+struct RenderParams_t {
+    int frameSize = 1024;
+    int tableRows = 256;
+    uint16_t trimThreshold = 0; // rows with a smaller peak-to-peak range get trimmed (0 = keep all)
+    SpectralSettings_t spectral;
+    AlignMode align = AlignMode::None;
+    LevelSettings_t levels;
+    ResizeSettings_t resize;
+    int loopCrossfade = 0; // samples on each side of the loop point to blend, 0 = off
+    bool reorder = false;  // sort frames into a smooth morphing order
+    int reduceFrames = 0;  // cluster the frames down to this many representatives, 0 = off
+    int dedupeTolerance = 0; // drop frames within this RMS distance (int16 steps) of a kept one, 0 = off
+    uint32_t seed = 0;     // for the k-means seeding and the duplicate hash projections
+};
+
+// what to make of an animated GIF
+enum class AnimationMode {
+    FirstFrame, // a still image, like any other file
+    Frames,     // a table per frame
+    Rows        // a row per frame, the table morphs through the animation
+};
+
+// what happens to the image once, right after decoding
+struct LoadSettings_t {
+    bool convertToLuma = false; // collapse to one luma channel before any resize
+    bool linearLight = false;   // linearize 16-bit data at load (see imageManager::LoadFromFile)
+    bool composite = false;     // composite alpha over the background and drop it
+    unsigned char background[3] = {0, 0, 0};
+    AnimationMode animation = AnimationMode::FirstFrame;
+    int frameStepMs = 0;        // sample the animation every so many ms, 0 = every frame
+};
+
+// keeps a decoded image resident so any number of parameter sets can be
+// rendered from it without going back to the file
+class ImageSession
+{
+    public:
+        bool Open(const std::string& imagePath, const LoadSettings_t& settings = {});
+        WaveTableWriter Render(const RenderParams_t& params) const;
+        std::vector<WaveTableWriter> RenderAll(const std::vector<RenderParams_t>& paramSets) const;
+        std::vector<WaveTableWriter> RenderPyramid(const std::vector<RenderParams_t>& paramSets) const;
+        std::vector<WaveTableWriter> RenderChannels(const RenderParams_t& params, const std::vector<ChannelMix_t>& mixes,
+                                                    bool linkedRows = false) const;
+        const imageManager& Image(void) const {return m_image;}
+        int AnimationRows(void) const {return m_animationRows;}
+    private:
+        imageManager m_image;
+        bool m_ready = false;
+        int m_animationRows = 0; // rows collapsed from animation frames, 0 = none
+};
+
+bool ImageSession::Open(const std::string& imagePath, const LoadSettings_t& settings)
+{
+    m_ready = m_image.LoadFromFile(imagePath, settings.linearLight, settings.animation != AnimationMode::FirstFrame);
+    if (!m_ready) {
+        std::cerr << "Image loader unable to process file: " << imagePath << std::endl;
+        return false;
+    }
+    if (settings.animation == AnimationMode::Rows) {
+        m_animationRows = m_image.CollapseFramesToRows(m_image.SelectFrames(settings.frameStepMs));
+    }
+    if (settings.composite) {
+        m_image.CompositeAlpha(settings.background);
+    }
+    if (settings.convertToLuma) {
+        m_image.ConvertToLuma(settings.linearLight);
+    }
+    return true;
+}
+
+static void ApplyRenderParams(const RenderParams_t& params, WaveTableWriter& writer)
+{
+    if (params.spectral.enabled) {
+        writer.SynthesizeFromSpectra(params.spectral);
+    }
+    if (params.trimThreshold > 0) {
+        int trimmed = writer.TrimData(params.trimThreshold);
+        printf("Trimmed %d rows from %d x %d table\n", trimmed, params.frameSize, params.tableRows);
+    }
+    if (params.dedupeTolerance > 0) {
+        std::vector<int> collapsed;
+        int removed = writer.RemoveDuplicateFrames(params.dedupeTolerance, params.seed, collapsed);
+        int buckets = 0;
+        for (size_t row = 0; row < collapsed.size(); ++row) {
+            if (collapsed[row] == 0) continue;
+            printf("  frame %d absorbed %d duplicates\n", (int)row, collapsed[row]);
+            buckets++;
+        }
+        printf("Removed %d near-duplicate frames in %d buckets\n", removed, buckets);
+    }
+    if (params.reduceFrames > 0) {
+        int removed = writer.ReduceFrames(params.reduceFrames, params.seed);
+        printf("Clustered away %d frames\n", removed);
+    }
+    if (params.reorder) {
+        writer.ReorderFrames();
+    }
+    if (params.loopCrossfade > 0) {
+        writer.CrossfadeLoopEdges(params.loopCrossfade);
+    }
+    if (params.align != AlignMode::None) {
+        writer.AlignFrames(params.align);
+    }
+    writer.ConditionLevels(params.levels);
+}
+
+// check DataReady() on the result to see if the render worked
+WaveTableWriter ImageSession::Render(const RenderParams_t& params) const
+{
+    WaveTableWriter writer(params.frameSize, params.tableRows);
+    if (m_ready && writer.GetDataFromSession(*this, params.resize)) {
+        ApplyRenderParams(params, writer);
+    }
+    return writer;
+}
+
+// renders are independent of each other, so they run in parallel
+std::vector<WaveTableWriter> ImageSession::RenderAll(const std::vector<RenderParams_t>& paramSets) const
+{
+    std::vector<WaveTableWriter> writers(paramSets.size());
+    ParallelFor((int)paramSets.size(), [&](int i) {
+        writers[i] = Render(paramSets[i]);
+    });
+    return writers;
+}
+
+// whether two renders resample the same source region the same way, so one's
+// resized pixels can stand in for (or be reduced to) the other's; the fixed
+// point flag only changes the conversion afterwards
+static bool SameResize(const ResizeSettings_t& a, const ResizeSettings_t& b)
+{
+    return a.interpolation == b.interpolation && a.wrapEdges == b.wrapEdges && a.linearLight == b.linearLight
+        && a.floatOutput == b.floatOutput && a.crop.x == b.crop.x && a.crop.y == b.crop.y
+        && a.crop.width == b.crop.width && a.crop.height == b.crop.height && a.crop.isolated == b.crop.isolated;
+}
+
+// Renders several geometries from one decode. Geometries are resized largest
+// first and each smaller one is derived from the smallest intermediate that
+// still covers it and was resized with the same settings, rather than from
+// the full resolution source every time. The per-size conversion (and
+// trimming) then runs in parallel.
+std::vector<WaveTableWriter> ImageSession::RenderPyramid(const std::vector<RenderParams_t>& paramSets) const
+{
+    int count = (int)paramSets.size();
+    std::vector<WaveTableWriter> writers(count);
+    if (!m_ready) return writers;
+
+    std::vector<int> order(count);
+    for (int i = 0; i < count; ++i) order[i] = i;
+    std::stable_sort(order.begin(), order.end(), [&](int a, int b) {
+        return paramSets[a].frameSize * paramSets[a].tableRows > paramSets[b].frameSize * paramSets[b].tableRows;
+    });
+
+    std::vector<PixelBuffer_t> levels(count);
+    std::vector<bool> levelReady(count, false);
+    for (int i : order) {
+        const RenderParams_t& params = paramSets[i];
+        const int rows = m_image.ResizedRows(params.tableRows, params.resize);
+        const PixelBuffer_t* parent = nullptr;
+        for (int j : order) {
+            if (!levelReady[j] || !SameResize(paramSets[j].resize, params.resize)) continue;
+            const PixelBuffer_t& level = levels[j];
+            if (level.width < params.frameSize || level.height < rows) continue;
+            if (!parent || level.width * level.height < parent->width * parent->height) {
+                parent = &level;
+            }
+        }
+
+        if (parent && parent->width == params.frameSize && parent->height == rows) {
+            levels[i] = *parent;
+            levelReady[i] = true;
+        } else if (parent) {
+            levels[i].width = params.frameSize;
+            levels[i].height = rows;
+            ResizeSettings_t levelSettings = params.resize;
+            levelSettings.crop = CropRect_t(); // the levels are cropped already
+            levelReady[i] = ResizePixels(parent->Data(), parent->DataType(), parent->linear, parent->width, parent->height, parent->channels,
+                                         levels[i], levelSettings);
+        } else {
+            levelReady[i] = m_image.GetResizedData(params.frameSize, params.tableRows, params.resize, levels[i]);
+        }
+    }
+
+    ParallelFor(count, [&](int i) {
+        writers[i] = WaveTableWriter(paramSets[i].frameSize, paramSets[i].tableRows);
+        if (levelReady[i] && writers[i].GetDataFromPixels(levels[i], paramSets[i].resize)) {
+            ApplyRenderParams(paramSets[i], writers[i]);
+        }
+    });
+    return writers;
+}
+
+// One resize of the full colour image, split into a table per channel mix.
+// linkedRows keeps the tables row aligned for interleaving into one file: they
+// are trimmed together and aligned with the same shifts, and the stages that
+// drop or move rows per table (dedupe, reduce, reorder) are not allowed.
+std::vector<WaveTableWriter> ImageSession::RenderChannels(const RenderParams_t& params,
+                                                          const std::vector<ChannelMix_t>& mixes, bool linkedRows) const
+{
+    std::vector<WaveTableWriter> writers(mixes.size());
+    PixelBuffer_t resized;
+    if (!m_ready || !m_image.GetResizedData(params.frameSize, params.tableRows, params.resize, resized)) {
+        return writers;
+    }
+    std::vector<std::vector<float>> planes = imageManager::SplitChannels(resized, mixes);
+    if (planes.empty()) return writers;
+
+    RenderParams_t stages = params;
+    if (linkedRows) {
+        // spectral resynthesis comes before trimming, as in ApplyRenderParams
+        ParallelFor((int)mixes.size(), [&](int i) {
+            writers[i] = WaveTableWriter(params.frameSize, params.tableRows);
+            if (writers[i].GetDataFromPlane(std::move(planes[i]), params.resize) && params.spectral.enabled) {
+                writers[i].SynthesizeFromSpectra(params.spectral);
+            }
+        });
+        if (params.trimThreshold > 0) {
+            int trimmed = WaveTableWriter::TrimLinked(writers, params.trimThreshold);
+            printf("Trimmed %d rows from %d x %d table\n", trimmed, params.frameSize, params.tableRows);
+        }
+        // alignment rotates the frames, so it's shared too; the loop fade
+        // comes before it, as in ApplyRenderParams
+        if (params.align != AlignMode::None) {
+            if (params.loopCrossfade > 0) {
+                ParallelFor((int)mixes.size(), [&](int i) {
+                    if (writers[i].DataReady()) writers[i].CrossfadeLoopEdges(params.loopCrossfade);
+                });
+                stages.loopCrossfade = 0;
+            }
+            WaveTableWriter::AlignLinked(writers, params.align);
+            stages.align = AlignMode::None;
+        }
+        stages.spectral.enabled = false;
+        stages.trimThreshold = 0;
+        stages.dedupeTolerance = 0;
+        stages.reduceFrames = 0;
+        stages.reorder = false;
+    }
+
+    ParallelFor((int)mixes.size(), [&](int i) {
+        if (!linkedRows) {
+            writers[i] = WaveTableWriter(params.frameSize, params.tableRows);
+            if (!writers[i].GetDataFromPlane(std::move(planes[i]), params.resize)) return;
+        } else if (!writers[i].DataReady()) {
+            return;
+        }
+        ApplyRenderParams(stages, writers[i]);
+    });
+    return writers;
+}
+
+bool WaveTableWriter::GetDataFromImageFile(const std::string& imagePath)
+{
+    ImageSession session;
+    if (!session.Open(imagePath)) {
+        return false;
+    }
+    return GetDataFromSession(session);
+}
+
+bool WaveTableWriter::GetDataFromSession(const ImageSession& session, const ResizeSettings_t& settings)
+{
+    m_wavData = session.Image().GetProcessedData(m_frameSize, m_tableRows, settings);
+    m_dataReady = !m_wavData.empty();
+    if (m_dataReady && RowCount() < m_tableRows) {
+        InterpolateFrames(settings.interpolation);
+    }
+    return m_dataReady;
+}
+
+bool WaveTableWriter::GetDataFromPixels(const PixelBuffer_t& resized, const ResizeSettings_t& settings)
+{
+    if (resized.width != m_frameSize) {
+        std::cerr << "Resized image does not match table geometry" << std::endl;
+        return false;
+    }
+    return GetDataFromPlane(imageManager::ConvertToWavetable(resized, settings), settings);
+}
+
+// takes over converted rows (-1..1, frameSize samples each)
+bool WaveTableWriter::GetDataFromPlane(std::vector<float>&& plane, const ResizeSettings_t& settings)
+{
+    const int rows = (int)(plane.size() / m_frameSize);
+    bool shortImage = rows < m_tableRows && settings.interpolation != FrameInterpolation::None;
+    if (plane.size() % m_frameSize != 0 || (rows != m_tableRows && !shortImage)) {
+        std::cerr << "Resized image does not match table geometry" << std::endl;
+        return false;
+    }
+    m_wavData = std::move(plane);
+    m_dataReady = !m_wavData.empty();
+    if (m_dataReady && shortImage) {
+        InterpolateFrames(settings.interpolation);
+    }
+    return m_dataReady;
+}
+
+// Stretches the frames present (a short image) to m_tableRows by interpolating
+// between neighbouring source frames. Output frames are independent of each
+// other and generated in parallel. Linear is a plain crossfade; spectral
+// interpolates each harmonic's magnitude linearly and its phase along the
+// shorter arc, which morphs instead of the dip a crossfade gives when the
+// rows are out of phase. DC and Nyquist are real and are crossfaded on their
+// real value, as a turning phase would swing them through imaginary.
+bool WaveTableWriter::InterpolateFrames(FrameInterpolation mode)
+{
+    const int sourceRows = RowCount();
+    if (mode == FrameInterpolation::None || sourceRows == 0 || sourceRows >= m_tableRows) {
+        return false;
+    }
+
+    std::vector<float> source;
+    source.swap(m_wavData);
+    m_wavData.resize((size_t)m_tableRows * m_frameSize);
+
+    // output frame j sits at source position j * (sourceRows - 1) / (m_tableRows - 1)
+    auto sourcePosition = [&](int frame, int& index, float& t) {
+        double position = m_tableRows > 1 ? (double)frame * (sourceRows - 1) / (m_tableRows - 1) : 0.0;
+        index = std::min((int)position, std::max(sourceRows - 2, 0));
+        t = sourceRows > 1 ? (float)(position - index) : 0.0f;
+    };
+
+    if (mode == FrameInterpolation::Linear || sourceRows == 1) {
+        ParallelFor(m_tableRows, [&](int frame) {
+            int index;
+            float t;
+            sourcePosition(frame, index, t);
+            const float* a = &source[(size_t)index * m_frameSize];
+            const float* b = &source[(size_t)std::min(index + 1, sourceRows - 1) * m_frameSize];
+            float* out = &m_wavData[(size_t)frame * m_frameSize];
+            for (int i = 0; i < m_frameSize; ++i) {
+                out[i] = a[i] + (b[i] - a[i]) * t;
+            }
+        });
+    } else {
+        const FftPlan& plan = FftPlan::Get(m_frameSize);
+        const int bins = plan.Bins();
+        std::vector<float> re((size_t)sourceRows * bins), im((size_t)sourceRows * bins);
+        plan.ForwardRows(source.data(), sourceRows, re.data(), im.data());
+
+        // polar form of every source spectrum, computed once
+        std::vector<float> magnitude(re.size()), phase(re.size());
+        for (size_t k = 0; k < re.size(); ++k) {
+            magnitude[k] = std::hypot(re[k], im[k]);
+            phase[k] = std::atan2(im[k], re[k]);
+        }
+
+        const float pi = 3.14159265f;
+        ParallelFor(m_tableRows, [&](int frame) {
+            int index;
+            float t;
+            sourcePosition(frame, index, t);
+            thread_local std::vector<float> outRe, outIm;
+            outRe.resize(bins);
+            outIm.resize(bins);
+            const size_t a = (size_t)index * bins, b = (size_t)(index + 1) * bins;
+            for (int k = 0; k < bins; ++k) {
+                if (k == 0 || 2 * k == m_frameSize) {
+                    outRe[k] = re[a + k] + (re[b + k] - re[a + k]) * t;
+                    outIm[k] = 0.0f;
+                    continue;
+                }
+                float delta = phase[b + k] - phase[a + k];
+                if (delta > pi) delta -= 2.0f * pi;
+                if (delta < -pi) delta += 2.0f * pi;
+                float m = magnitude[a + k] + (magnitude[b + k] - magnitude[a + k]) * t;
+                float p = phase[a + k] + delta * t;
+                outRe[k] = m * std::cos(p);
+                outIm[k] = m * std::sin(p);
+            }
+            plan.Inverse(outRe.data(), outIm.data(), &m_wavData[(size_t)frame * m_frameSize]);
+        });
+    }
+
+    printf("Interpolated %d source rows to %d frames\n", sourceRows, m_tableRows);
+    return true;
+}
+
+// RIFF/WAVE file around interleaved sample bytes. Float and 24-bit or more
+// than 2 channels need the extended fmt chunk; non-PCM formats a fact chunk.
+static bool WriteWavFile(const std::string& filename, SampleFormat format, int numChannels,
+                         const unsigned char* samples, uint32_t dataSize)
+{
+    const int bytesPerSample = SampleFormatBytes(format);
+    const bool padByte = dataSize & 1; // RIFF chunks are word aligned
+
+    // Create WAV header
+    WavFmtChunk_t fmt;
+    fmt.numChannels = (uint16_t)numChannels;
+    fmt.sampleRate = 48000;
+    fmt.bitsPerSample = bytesPerSample * 8;
+    fmt.blockAlign = fmt.numChannels * bytesPerSample;
+    fmt.byteRate = fmt.sampleRate * fmt.blockAlign;
+    if (format == SampleFormat::Float32 && numChannels <= 2) {
+        // non-PCM formats need the cbSize field and a fact chunk
+        fmt.audioFormat = 3; // WAVE_FORMAT_IEEE_FLOAT
+        fmt.fmtSize = 18;
+    } else if (format == SampleFormat::Int24 || numChannels > 2) {
+        // more than 16 bits per sample or 2 channels should use WAVE_FORMAT_EXTENSIBLE
+        static const uint8_t pcmSubFormat[16] = {0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x10, 0x00,
+                                                 0x80, 0x00, 0x00, 0xAA, 0x00, 0x38, 0x9B, 0x71};
+        fmt.audioFormat = 0xFFFE;
+        fmt.fmtSize = 40;
+        fmt.cbSize = 22;
+        fmt.validBitsPerSample = fmt.bitsPerSample;
+        // front center for mono, front left/right, then the next speakers in order
+        fmt.channelMask = numChannels == 1 ? 0x4 : (uint32_t)((1ull << std::min(numChannels, 18)) - 1);
+        memcpy(fmt.subFormat, pcmSubFormat, sizeof(pcmSubFormat));
+        if (format == SampleFormat::Float32) fmt.subFormat[0] = 0x03; // KSDATAFORMAT_SUBTYPE_IEEE_FLOAT
+    }
+
+    WavChunkHeader_t fact = {{'f', 'a', 'c', 't'}, 4};
+    uint32_t factSampleLength = dataSize / fmt.blockAlign;
+    bool writeFact = fmt.audioFormat != 1;
+    WavChunkHeader_t data = {{'d', 'a', 't', 'a'}, dataSize};
+
+    RiffHeader_t riff;
+    riff.riffSize = 4 + (8 + fmt.fmtSize) + (writeFact ? 12 : 0) + 8 + dataSize + (padByte ? 1 : 0);
+
+    // Write to WAV file
+    std::ofstream wavFile(filename, std::ios::binary);
+    if (!wavFile.is_open()) {
+        std::cerr << "Error opening WAV file: " << filename << std::endl;
+        return false;
+    }
+    
+    // Write header
+    wavFile.write(reinterpret_cast<const char*>(&riff), sizeof(RiffHeader_t));
+    wavFile.write(reinterpret_cast<const char*>(&fmt), 8 + fmt.fmtSize);
+    if (writeFact) {
+        wavFile.write(reinterpret_cast<const char*>(&fact), sizeof(WavChunkHeader_t));
+        wavFile.write(reinterpret_cast<const char*>(&factSampleLength), sizeof(factSampleLength));
+    }
+    wavFile.write(reinterpret_cast<const char*>(&data), sizeof(WavChunkHeader_t));
+    wavFile.write(reinterpret_cast<const char*>(samples), dataSize);
+    if (padByte) wavFile.put(0);
+    
+    wavFile.close();
+    return true;
+}
+
+bool WaveTableWriter::WriteWaveTableToFile(const std::string& filename, bool invert) const
+{
+    if (!m_dataReady) {
+        std::cerr << "Data is not ready for writing!" << std::endl;
+        return false;
+    }
+
+    const size_t sampleCount = m_wavData.size();
+    const uint32_t dataSize = (uint32_t)(sampleCount * SampleFormatBytes(m_sampleFormat));
+
+    // float output goes straight out of m_wavData unless it has to be inverted
+    bool written;
+    if (m_sampleFormat == SampleFormat::Float32 && !invert) {
+        written = WriteWavFile(filename, m_sampleFormat, 1, reinterpret_cast<const unsigned char*>(m_wavData.data()), dataSize);
+    } else {
+        std::vector<unsigned char> samples(dataSize);
+        QuantizeSamples({m_wavData.data()}, sampleCount, m_frameSize, invert ? -1.0f : 1.0f,
+                        m_sampleFormat, m_dither, samples.data());
+        written = WriteWavFile(filename, m_sampleFormat, 1, samples.data(), dataSize);
+    }
+    if (!written) return false;
+
+    // get the real row size (could have been reduced on trimming)
+    std::cout << "Created WAV file with " << RowCount() << " rows of " 
+              << m_frameSize << " samples each" << std::endl;
+
+    return true;
+}
+
+// One WAV with a channel per table, e.g. two channel tables for a stereo
+// wavetable. The tables must have the same geometry (see TrimLinked); sample
+// format and dither come from the first one.
+bool WaveTableWriter::WriteMultiChannelFile(const std::vector<WaveTableWriter>& channels,
+                                            const std::string& filename, bool invert)
+{
+    if (channels.empty()) return false;
+    std::vector<const float*> planes;
+    for (const WaveTableWriter& channel : channels) {
+        if (!channel.m_dataReady) {
+            std::cerr << "Data is not ready for writing!" << std::endl;
+            return false;
+        }
+        if (channel.m_frameSize != channels[0].m_frameSize || channel.m_wavData.size() != channels[0].m_wavData.size()) {
+            std::cerr << "Channel tables differ in size, can't interleave them" << std::endl;
+            return false;
+        }
+        planes.push_back(channel.m_wavData.data());
+    }
+
+    const WaveTableWriter& first = channels[0];
+    const size_t sampleCount = first.m_wavData.size();
+    const uint32_t dataSize = (uint32_t)(sampleCount * planes.size() * SampleFormatBytes(first.m_sampleFormat));
+    std::vector<unsigned char> samples(dataSize);
+    QuantizeSamples(planes, sampleCount, first.m_frameSize, invert ? -1.0f : 1.0f,
+                    first.m_sampleFormat, first.m_dither, samples.data());
+    if (!WriteWavFile(filename, first.m_sampleFormat, (int)planes.size(), samples.data(), dataSize)) return false;
+
+    std::cout << "Created " << planes.size() << " channel WAV file with " << first.RowCount() << " rows of "
+              << first.m_frameSize << " samples each" << std::endl;
+    return true;
+}
+
+// FFT of every row, RowCount() x (frameSize/2 + 1) bins each
+bool WaveTableWriter::GetSpectra(std::vector<float>& re, std::vector<float>& im) const
+{
+    if (!m_dataReady) {
+        std::cerr << "Data is not ready!" << std::endl;
+        return false;
+    }
+    const FftPlan& plan = FftPlan::Get(m_frameSize);
+    re.resize((size_t)RowCount() * plan.Bins());
+    im.resize((size_t)RowCount() * plan.Bins());
+    plan.ForwardRows(m_wavData.data(), RowCount(), re.data(), im.data());
+    return true;
+}
+
+// Band-limited copies of the table, one per octave: copy k keeps only the
+// harmonics that stay below Nyquist when played k octaves above the base pitch
+// (frameSize/2 >> k). All copies share one forward FFT of every row; the
+// truncation and inverse FFT run across rows in parallel.
+std::vector<WaveTableWriter> WaveTableWriter::BuildMipmaps(int octaves) const
+{
+    std::vector<WaveTableWriter> mipmaps;
+    std::vector<float> re, im;
+    if (!GetSpectra(re, im)) {
+        return mipmaps;
+    }
+
+    const FftPlan& plan = FftPlan::Get(m_frameSize);
+    const int bins = plan.Bins();
+    const int maxHarmonic = m_frameSize / 2;
+    for (int octave = 1; octave <= octaves && (maxHarmonic >> octave) >= 1; ++octave) {
+        const int limit = maxHarmonic >> octave;
+        WaveTableWriter mipmap(*this);
+        ParallelFor(RowCount(), [&](int row) {
+            thread_local std::vector<float> rowRe, rowIm;
+            rowRe.assign(bins, 0.0f);
+            rowIm.assign(bins, 0.0f);
+            std::copy(&re[(size_t)row * bins], &re[(size_t)row * bins] + limit + 1, rowRe.begin());
+            std::copy(&im[(size_t)row * bins], &im[(size_t)row * bins] + limit + 1, rowIm.begin());
+            plan.Inverse(rowRe.data(), rowIm.data(), &mipmap.m_wavData[(size_t)row * m_frameSize]);
+        });
+        mipmaps.push_back(std::move(mipmap));
+    }
+    return mipmaps;
+}
+
+// Spectral mode: every row of the (resized, normalized) image is taken as the
+// magnitude spectrum of its frame, pixel brightness -> harmonic amplitude, and
+// turned into a waveform by inverse FFT. The frameSize pixels of a row are
+// averaged in pairs onto the frameSize/2 harmonics; DC stays zero. Phases are
+// the same for every row so neighbouring frames morph smoothly. All rows are
+// synthesized in one batched inverse FFT and the table is then scaled to a
+// common peak, so brighter rows stay louder.
+bool WaveTableWriter::SynthesizeFromSpectra(const SpectralSettings_t& settings)
 {
-    public:
-        imageManager(int frameSize = 1024, int tableRows = 256)
-            : m_frameSize(frameSize), m_tableRows(tableRows)
-            {}
-        ~imageManager()
-            {stbi_image_free(m_rawImageData);}
-        bool LoadFromFile(const std::string& imagePath);
-        std::vector<int16_t> GetProcessedData(void);
+    if (!m_dataReady) {
+        std::cerr << "Data is not ready!" << std::endl;
+        return false;
+    }
 
-    private:
-        unsigned char* m_rawImageData;
-        int m_frameSize;
-        int m_tableRows;
-        int m_height;
-        int m_width;
-        int m_channels;
-};
+    const FftPlan& plan = FftPlan::Get(m_frameSize);
+    const int bins = plan.Bins();
+    const int harmonics = m_frameSize / 2;
+    const int rows = RowCount();
+
+    // unit phasors per harmonic
+    const double pi = 3.141592653589793;
+    const uint32_t seedMix = HashCounter(settings.seed, 0x85EBCA6Bu);
+    std::vector<float> phaseRe(bins, 0.0f), phaseIm(bins, 0.0f);
+    for (int k = 1; k <= harmonics; ++k) {
+        double phase = 0.0;
+        if (settings.phase == SpectralPhase::Schroeder) {
+            phase = -pi * k * (k - 1) / harmonics;
+        } else if (settings.phase == SpectralPhase::Random) {
+            phase = 2.0 * pi * (HashCounter((uint32_t)k, seedMix) / 4294967296.0);
+        }
+        // the Nyquist bin of a real frame is real: snap it to 0 or pi
+        if (k == harmonics && m_frameSize % 2 == 0) {
+            phase = cos(phase) < 0.0 ? pi : 0.0;
+        }
+        phaseRe[k] = (float)cos(phase);
+        phaseIm[k] = (float)sin(phase);
+    }
+
+    std::vector<float> re((size_t)rows * bins), im((size_t)rows * bins);
+    ParallelFor(rows, [&](int row) {
+        const float* in = &m_wavData[(size_t)row * m_frameSize];
+        float* rowRe = &re[(size_t)row * bins];
+        float* rowIm = &im[(size_t)row * bins];
+        rowRe[0] = rowIm[0] = 0.0f;
+        for (int k = 1; k < bins; ++k) {
+            // back from -1..1 to brightness 0..1
+            int first = 2 * (k - 1);
+            int second = std::min(first + 1, m_frameSize - 1);
+            float magnitude = 0.25f * ((in[first] + 1.0f) + (in[second] + 1.0f));
+            rowRe[k] = magnitude * phaseRe[k];
+            rowIm[k] = magnitude * phaseIm[k];
+        }
+    });
+    plan.InverseRows(re.data(), im.data(), rows, m_wavData.data());
+
+    float peak = 0.0f;
+    for (float sample : m_wavData) peak = std::max(peak, std::fabs(sample));
+    if (peak > 0.0f) {
+        const float gain = 1.0f / peak;
+        for (float& sample : m_wavData) sample *= gain;
+    }
+
+    printf("Synthesized %d frames from row spectra\n", rows);
+    return true;
+}
 
-bool imageManager::LoadFromFile(const std::string& imagePath)
+// Circularly shifts frames so consecutive rows line up in phase. For cross
+// correlation the lag between each frame and its (unshifted) predecessor is
+// found via FFT (X[r] * conj(X[r-1]) -> IFFT -> argmax), all rows in parallel;
+// the shifts are then accumulated down the table, since shifting a frame by the
+// predecessor's shift plus the pairwise lag matches it to the shifted predecessor.
+bool WaveTableWriter::AlignFrames(AlignMode mode)
 {
-    // only accepting RGB 3 channel images for now; could be enhanced to handle different images
-    m_rawImageData = stbi_load(imagePath.c_str(), &m_width, &m_height, &m_channels, 0);  
-    if (!m_rawImageData) {
-        std::cerr << "Unknown error loading image: " << imagePath << std::endl;
+    if (!m_dataReady) {
+        std::cerr << "Data is not ready!" << std::endl;
         return false;
     }
+    ShiftFrames(FrameShifts(mode));
+    return true;
+}
+
+// Aligns the channel tables of one multichannel file: the shifts are found on
+// the first channel and applied to every channel, so the channels of a row
+// stay in step with each other.
+bool WaveTableWriter::AlignLinked(std::vector<WaveTableWriter>& channels, AlignMode mode)
+{
+    if (channels.empty()) return false;
+    const int rows = channels[0].RowCount();
+    for (const WaveTableWriter& channel : channels) {
+        if (!channel.m_dataReady || channel.RowCount() != rows || channel.m_frameSize != channels[0].m_frameSize) {
+            std::cerr << "Channel tables differ in size, can't align them together" << std::endl;
+            return false;
+        }
+    }
+    const std::vector<int> shifts = channels[0].FrameShifts(mode);
+    for (WaveTableWriter& channel : channels) {
+        channel.ShiftFrames(shifts);
+    }
+    return true;
+}
 
-    if (m_height < m_tableRows) {
-        std::cerr << "Image not tall enough for requested rows\n" << std::endl;
+std::vector<int> WaveTableWriter::FrameShifts(AlignMode mode) const
+{
+    const int rows = RowCount();
+    std::vector<int> shifts(rows, 0);
+    if (mode == AlignMode::ZeroCrossing) {
+        ParallelFor(rows, [&](int row) {
+            const float* in = &m_wavData[(size_t)row * m_frameSize];
+            for (int i = 0; i < m_frameSize; ++i) {
+                float previous = in[(i + m_frameSize - 1) % m_frameSize];
+                if (previous < 0.0f && in[i] >= 0.0f) {
+                    shifts[row] = i;
+                    break;
+                }
+            }
+        });
+    } else if (mode == AlignMode::CrossCorrelation && rows > 1) {
+        std::vector<float> re, im;
+        GetSpectra(re, im);
+        const FftPlan& plan = FftPlan::Get(m_frameSize);
+        const int bins = plan.Bins();
+        std::vector<int> lags(rows, 0);
+        ParallelFor(rows - 1, [&](int pair) {
+            thread_local std::vector<float> crossRe, crossIm, correlation;
+            crossRe.resize(bins);
+            crossIm.resize(bins);
+            correlation.resize(m_frameSize);
+            const float* aRe = &re[(size_t)(pair + 1) * bins];
+            const float* aIm = &im[(size_t)(pair + 1) * bins];
+            const float* bRe = &re[(size_t)pair * bins];
+            const float* bIm = &im[(size_t)pair * bins];
+            for (int k = 0; k < bins; ++k) {
+                crossRe[k] = aRe[k] * bRe[k] + aIm[k] * bIm[k];
+                crossIm[k] = aIm[k] * bRe[k] - aRe[k] * bIm[k];
+            }
+            plan.Inverse(crossRe.data(), crossIm.data(), correlation.data());
+            lags[pair + 1] = (int)(std::max_element(correlation.begin(), correlation.end()) - correlation.begin());
+        });
+        for (int row = 1; row < rows; ++row) {
+            shifts[row] = (shifts[row - 1] + lags[row]) % m_frameSize;
+        }
+    }
+    return shifts;
+}
+
+void WaveTableWriter::ShiftFrames(const std::vector<int>& shifts)
+{
+    ParallelFor(RowCount(), [&](int row) {
+        float* frame = &m_wavData[(size_t)row * m_frameSize];
+        std::rotate(frame, frame + shifts[row], frame + m_frameSize);
+    });
+}
+
+// Makes every frame continuous across its loop point: the jump between the
+// last and first sample is split in half and faded out over fadeLength samples
+// on either side with a raised cosine, so the end of the frame bends up to
+// meet the start and vice versa. The fade weights are shared by all rows, and
+// each row is one branch-free pass over its edges.
+bool WaveTableWriter::CrossfadeLoopEdges(int fadeLength)
+{
+    if (!m_dataReady) {
+        std::cerr << "Data is not ready!" << std::endl;
         return false;
     }
+
+    fadeLength = std::min(fadeLength, m_frameSize / 2);
+    if (fadeLength <= 0) return true;
+
+    // weights[j] for the sample j steps away from the loop point, 1 at the edge
+    const double pi = 3.141592653589793;
+    std::vector<float> weights(fadeLength);
+    for (int j = 0; j < fadeLength; ++j) {
+        weights[j] = (float)(0.5 * (1.0 + cos(pi * j / fadeLength)));
+    }
+
+    ParallelFor(RowCount(), [&](int row) {
+        float* frame = &m_wavData[(size_t)row * m_frameSize];
+        float* tail = frame + m_frameSize - 1;
+        const float halfJump = 0.5f * (frame[0] - *tail);
+        for (int j = 0; j < fadeLength; ++j) {
+            frame[j] -= halfJump * weights[j];
+            tail[-j] += halfJump * weights[j];
+        }
+    });
     return true;
 }
 
-std::vector<int16_t> imageManager::GetProcessedData(void)
+// Reorders frames so that neighbours are as similar as possible, which makes
+// wavetable position sweeps smooth. Squared distances between all frames come
+// from dot products (|a|^2 + |b|^2 - 2 a.b) computed in parallel; the order is
+// a nearest-neighbour path (best of several start frames) refined by 2-opt
+// segment reversals until no reversal shortens the path.
+bool WaveTableWriter::ReorderFrames(void)
 {
-    // ----- Start by resizing the image to target wavetable size -----
-    int dst_width = m_frameSize;
-    int dst_height = m_tableRows;
-    
-    // Allocate memory for the resized image (could be refactored)
-    unsigned char *dst_data = (unsigned char*)malloc(dst_width * dst_height * m_channels);
-    
-    if (!dst_data) {
-        std::cerr << "Memory allocation failed\n";
-        exit(1);
+    if (!m_dataReady) {
+        std::cerr << "Data is not ready!" << std::endl;
+        return false;
     }
-    
-    // Perform the resize operation using stbir_resize_uint8_linear
-    unsigned char* result = stbir_resize_uint8_linear(
-        m_rawImageData,  // source image data 
-        m_width,         // source width
-        m_height,        // source height
-        0,               // source stride in bytes (0 = computed automatically)
-        dst_data,        // destination image data
-        dst_width,       // destination width
-        dst_height,      // destination height
-        0,               // destination stride in bytes (0 = computed automatically)
-        (stbir_pixel_layout)m_channels // number of channels
-    );
-    
-    if (result == 0) {
-        printf("Resize operation failed\n");
-        free(dst_data);
-        exit(1);
+
+    const int rows = RowCount();
+    if (rows < 3) return true;
+
+    std::vector<float> norms(rows);
+    ParallelFor(rows, [&](int row) {
+        const float* frame = &m_wavData[(size_t)row * m_frameSize];
+        norms[row] = DotProduct(frame, frame, m_frameSize);
+    });
+    std::vector<float> distance((size_t)rows * rows, 0.0f);
+    ParallelFor(rows, [&](int i) {
+        const float* a = &m_wavData[(size_t)i * m_frameSize];
+        for (int j = i + 1; j < rows; ++j) {
+            float d = norms[i] + norms[j] - 2.0f * DotProduct(a, &m_wavData[(size_t)j * m_frameSize], m_frameSize);
+            distance[(size_t)i * rows + j] = distance[(size_t)j * rows + i] = std::max(d, 0.0f);
+        }
+    });
+    auto dist = [&](int a, int b) { return distance[(size_t)a * rows + b]; };
+    auto pathLength = [&](const std::vector<int>& path) {
+        double total = 0.0;
+        for (size_t i = 1; i < path.size(); ++i) total += dist(path[i - 1], path[i]);
+        return total;
+    };
+
+    // nearest neighbour paths from a spread of start frames, keep the shortest
+    // (every start would be O(rows^3); 2-opt below fixes up most of the difference)
+    const int starts = std::min(rows, 16);
+    std::vector<std::vector<int>> paths(starts);
+    std::vector<double> lengths(starts);
+    ParallelFor(starts, [&](int startIndex) {
+        const int start = (int)((long long)startIndex * rows / starts);
+        std::vector<int>& path = paths[startIndex];
+        std::vector<char> used(rows, 0);
+        path.push_back(start);
+        used[start] = 1;
+        for (int step = 1; step < rows; ++step) {
+            const float* candidates = &distance[(size_t)path.back() * rows];
+            int best = -1;
+            float bestDistance = 0.0f;
+            for (int candidate = 0; candidate < rows; ++candidate) {
+                if (!used[candidate] && (best < 0 || candidates[candidate] < bestDistance)) {
+                    best = candidate;
+                    bestDistance = candidates[candidate];
+                }
+            }
+            path.push_back(best);
+            used[best] = 1;
+        }
+        lengths[startIndex] = pathLength(path);
+    });
+    std::vector<int> order = paths[std::min_element(lengths.begin(), lengths.end()) - lengths.begin()];
+    double before = pathLength(order);
+
+    // 2-opt on an open path: reversing order[i+1..j] swaps edges (i,i+1),(j,j+1)
+    // for (i,j),(i+1,j+1); j == rows-1 has no outgoing edge, i == -1 no incoming one
+    bool improved = true;
+    while (improved) {
+        improved = false;
+        for (int i = -1; i < rows - 2; ++i) {
+            for (int j = i + 2; j < rows; ++j) {
+                double removed = (i >= 0 ? dist(order[i], order[i + 1]) : 0.0)
+                               + (j + 1 < rows ? dist(order[j], order[j + 1]) : 0.0);
+                double added = (i >= 0 ? dist(order[i], order[j]) : 0.0)
+                             + (j + 1 < rows ? dist(order[i + 1], order[j + 1]) : 0.0);
+                if (added + 1e-9 < removed) {
+                    std::reverse(order.begin() + i + 1, order.begin() + j + 1);
+                    improved = true;
+                }
+            }
+        }
     }
-    
-    printf("Image resized successfully to %d x %d\n", dst_width, dst_height);
 
-    // Convert to grayscale
-    std::vector<float> grayscaleData(m_frameSize * m_tableRows);
-    for (int i = 0; i < m_frameSize * m_tableRows; ++i) {
-        unsigned char r = dst_data[i * m_channels];
-        unsigned char g = m_channels > 1 ? m_rawImageData[i * m_channels + 1] : r;
-        unsigned char b = m_channels > 2 ? m_rawImageData[i * m_channels + 2] : r;
-        grayscaleData[i] = (0.2989f * r + 0.587f * g + 0.114f * b) / 255.0f;
-        //if (i < 1024) cout << " " << grayscaleData[i] << ",";
+    std::vector<float> reordered(m_wavData.size());
+    ParallelFor(rows, [&](int row) {
+        std::copy_n(&m_wavData[(size_t)order[row] * m_frameSize], m_frameSize, &reordered[(size_t)row * m_frameSize]);
+    });
+    m_wavData.swap(reordered);
+
+    std::vector<int> identity(rows);
+    for (int row = 0; row < rows; ++row) identity[row] = row;
+    printf("Reordered %d frames, adjacent distance %.1f -> %.1f (greedy %.1f)\n",
+           rows, pathLength(identity), pathLength(order), before);
+    return true;
+}
+
+// Removes near-duplicate frames in roughly linear time with locality
+// sensitive hashing. Every frame is projected on a set of seeded random +-1
+// vectors (one SIMD dot product each, parallel over frames) and the
+// projections, quantized to buckets much wider than the tolerance, are hashed
+// in bands. Frames that share a band bucket with an earlier kept frame are
+// compared exactly and dropped if their RMS difference is within tolerance
+// (int16 steps), so the hashing only narrows the search and never merges
+// frames that aren't close. A pair right at the tolerance can occasionally
+// miss every band and survive. collapsed gets, per remaining row, how many
+// frames were folded into it. Returns the number of frames removed.
+int WaveTableWriter::RemoveDuplicateFrames(int tolerance, uint32_t seed, std::vector<int>& collapsed)
+{
+    collapsed.clear();
+    if (!m_dataReady) {
+        std::cerr << "Data is not ready!" << std::endl;
+        return 0;
     }
 
-    printf("Converted to grayscale\n");
+    const int rows = RowCount();
+    const int bands = 6;
+    const int bandWidth = 6;
+    const int projections = bands * bandWidth;
+    const float limit = tolerance / 32767.0f;
+    const float bucketWidth = 16.0f * limit;
+    auto frame = [&](int row) { return &m_wavData[(size_t)row * m_frameSize]; };
 
-    std::vector<int16_t> wavetableData(m_frameSize * m_tableRows);
-    int writeRow = m_tableRows - 1; // use this to write it out backwards (since Ableton starts at bottom)
-    for (int row = 0; row < m_tableRows; row++)
-    {
-        for (int i = 0; i < m_frameSize; ++i)
-        {
-            // the grayscale values range from 0 to 1, we normalize this from -1 to 1 to create the wav
-            float normalizedSample = grayscaleData[row * m_frameSize + i] * 2.0f - 1.0f;
-            // then scale the floating point values to min/max for int16
-            wavetableData[writeRow * m_frameSize + i] = static_cast<int16_t>(normalizedSample * 32767.0f);
+    // +-1 / sqrt(n) vectors, so a projection of the difference of two frames
+    // is spread about as wide as their RMS difference
+    const uint32_t seedMix = HashCounter(seed, 0x27D4EB2Fu);
+    const float scale = 1.0f / std::sqrt((float)m_frameSize);
+    std::vector<float> planes((size_t)projections * m_frameSize);
+    std::vector<float> offsets(projections);
+    for (int p = 0; p < projections; ++p) {
+        for (int i = 0; i < m_frameSize; ++i) {
+            uint32_t hash = HashCounter((uint32_t)(p * m_frameSize + i), seedMix);
+            planes[(size_t)p * m_frameSize + i] = (hash & 1) ? scale : -scale;
         }
-        writeRow--;
+        offsets[p] = HashCounter((uint32_t)p, ~seedMix) / 4294967296.0f;
     }
 
-    printf("Converted to wavetable\n");
+    std::vector<uint64_t> keys((size_t)rows * bands);
+    ParallelFor(rows, [&](int row) {
+        for (int b = 0; b < bands; ++b) {
+            uint64_t key = 0xCBF29CE484222325ull + (uint64_t)b;
+            for (int j = 0; j < bandWidth; ++j) {
+                int p = b * bandWidth + j;
+                float projection = DotProduct(frame(row), &planes[(size_t)p * m_frameSize], m_frameSize);
+                int64_t bucket = (int64_t)std::floor(projection / bucketWidth + offsets[p]);
+                key = (key ^ (uint64_t)bucket) * 0x100000001B3ull;
+            }
+            keys[(size_t)row * bands + b] = key;
+        }
+    });
 
-    // Clean up
-    free(dst_data);
+    // keep the first frame of every group, in order
+    std::vector<std::unordered_map<uint64_t, std::vector<int>>> tables(bands);
+    std::vector<int> keptIndex(rows, -1);
+    std::vector<int> keep;
+    for (int row = 0; row < rows; ++row) {
+        int match = -1;
+        for (int b = 0; b < bands && match < 0; ++b) {
+            auto bucket = tables[b].find(keys[(size_t)row * bands + b]);
+            if (bucket == tables[b].end()) continue;
+            for (int candidate : bucket->second) {
+                const float* x = frame(row);
+                const float* y = frame(candidate);
+                double sum = 0.0;
+                for (int i = 0; i < m_frameSize; ++i) sum += (double)(x[i] - y[i]) * (x[i] - y[i]);
+                if (sum <= (double)limit * limit * m_frameSize) {
+                    match = candidate;
+                    break;
+                }
+            }
+        }
+        if (match >= 0) {
+            collapsed[keptIndex[match]]++;
+            continue;
+        }
+        keptIndex[row] = (int)keep.size();
+        keep.push_back(row);
+        collapsed.push_back(0);
+        for (int b = 0; b < bands; ++b) tables[b][keys[(size_t)row * bands + b]].push_back(row);
+    }
 
-    return wavetableData;
+    std::vector<float> unique(keep.size() * m_frameSize);
+    for (size_t i = 0; i < keep.size(); ++i) {
+        std::copy_n(frame(keep[i]), m_frameSize, &unique[i * m_frameSize]);
+    }
+    m_wavData.swap(unique);
+    return rows - (int)keep.size();
 }
 
-class WaveTableWriter
+// Reduces the table to targetFrames representative frames with k-means:
+// k-means++ seeding from a seeded counter PRNG, then Lloyd iterations where
+// the frame to centroid distances (|x|^2 + |c|^2 - 2 x.c on the SIMD dot
+// product) are computed in parallel across frames. Each cluster is then
+// represented by its member closest to the centroid, so the output contains
+// real frames rather than blurred averages, and representatives keep their
+// original relative order. The result only depends on the data and the seed.
+// Returns the number of frames removed.
+int WaveTableWriter::ReduceFrames(int targetFrames, uint32_t seed)
 {
-    public:
-        WaveTableWriter(int frameSize = 1024, int tableRows = 256)
-            : m_frameSize(frameSize), m_tableRows(tableRows) {}
-        ~WaveTableWriter() {}        
-        bool GetDataFromImageFile(const std::string& imagePath);
-        bool WriteWaveTableToFile(const std::string& filename, bool invert);
-        int TrimData(uint16_t thresholdVariance);
-        void PrintRowMinMax(void);
-    private:
-        int m_frameSize;
-        int m_tableRows;
-        std::vector<int16_t> m_wavData;
-        bool m_dataReady = false;
+    if (!m_dataReady) {
+        std::cerr << "Data is not ready!" << std::endl;
+        return 0;
+    }
+
+    const int rows = RowCount();
+    const int k = targetFrames;
+    if (k <= 0 || rows <= k) return 0;
+
+    const uint32_t seedMix = HashCounter(seed, 0xC2B2AE35u);
+    uint32_t counter = 0;
+    auto uniform = [&]() { return HashCounter(counter++, seedMix) / 4294967296.0; };
+    auto frame = [&](int row) { return &m_wavData[(size_t)row * m_frameSize]; };
+
+    std::vector<float> norms(rows);
+    ParallelFor(rows, [&](int row) { norms[row] = DotProduct(frame(row), frame(row), m_frameSize); });
+
+    // k-means++: each new centroid is a frame picked with probability
+    // proportional to its squared distance from the nearest centroid so far
+    std::vector<float> centroids((size_t)k * m_frameSize);
+    std::vector<float> centroidNorms(k);
+    std::vector<double> nearest(rows, std::numeric_limits<double>::max());
+    int pick = (int)(uniform() * rows);
+    for (int c = 0; c < k; ++c) {
+        std::copy_n(frame(pick), m_frameSize, &centroids[(size_t)c * m_frameSize]);
+        centroidNorms[c] = norms[pick];
+        ParallelFor(rows, [&](int row) {
+            double d = norms[row] + norms[pick] - 2.0 * DotProduct(frame(row), frame(pick), m_frameSize);
+            nearest[row] = std::min(nearest[row], std::max(d, 0.0));
+        });
+        double total = 0.0;
+        for (double d : nearest) total += d;
+        if (total <= 0.0) {
+            pick = (int)(uniform() * rows); // all remaining frames are duplicates
+            continue;
+        }
+        double target = uniform() * total;
+        for (pick = 0; pick < rows - 1; ++pick) {
+            target -= nearest[pick];
+            if (target < 0.0) break;
+        }
+    }
+
+    // Lloyd iterations
+    std::vector<int> assignment(rows, -1);
+    std::vector<float> distances(rows);
+    const int maxIterations = 25;
+    for (int iteration = 0; iteration < maxIterations; ++iteration) {
+        std::atomic<int> changed(0);
+        ParallelFor(rows, [&](int row) {
+            int best = 0;
+            float bestDistance = std::numeric_limits<float>::max();
+            for (int c = 0; c < k; ++c) {
+                float d = norms[row] + centroidNorms[c] - 2.0f * DotProduct(frame(row), &centroids[(size_t)c * m_frameSize], m_frameSize);
+                if (d < bestDistance) {
+                    bestDistance = d;
+                    best = c;
+                }
+            }
+            if (assignment[row] != best) changed++;
+            assignment[row] = best;
+            distances[row] = bestDistance;
+        });
+        if (changed == 0) break;
+
+        // new centroids are member means; an empty cluster takes the worst fitting frame
+        std::vector<int> counts(k, 0);
+        std::fill(centroids.begin(), centroids.end(), 0.0f);
+        for (int row = 0; row < rows; ++row) {
+            float* centroid = &centroids[(size_t)assignment[row] * m_frameSize];
+            const float* in = frame(row);
+            for (int i = 0; i < m_frameSize; ++i) centroid[i] += in[i];
+            counts[assignment[row]]++;
+        }
+        for (int c = 0; c < k; ++c) {
+            float* centroid = &centroids[(size_t)c * m_frameSize];
+            if (counts[c] == 0) {
+                int worst = (int)(std::max_element(distances.begin(), distances.end()) - distances.begin());
+                std::copy_n(frame(worst), m_frameSize, centroid);
+                distances[worst] = 0.0f;
+            } else {
+                const float scale = 1.0f / counts[c];
+                for (int i = 0; i < m_frameSize; ++i) centroid[i] *= scale;
+            }
+            centroidNorms[c] = DotProduct(centroid, centroid, m_frameSize);
+        }
+    }
+
+    // representative = member closest to its centroid, ties to the lower row
+    std::vector<int> representative(k, -1);
+    for (int row = 0; row < rows; ++row) {
+        int c = assignment[row];
+        if (representative[c] < 0 || distances[row] < distances[representative[c]]) {
+            representative[c] = row;
+        }
+    }
+    std::vector<int> keep;
+    for (int row : representative) {
+        if (row >= 0) keep.push_back(row);
+    }
+    std::sort(keep.begin(), keep.end());
+
+    std::vector<float> reduced(keep.size() * m_frameSize);
+    for (size_t i = 0; i < keep.size(); ++i) {
+        std::copy_n(frame(keep[i]), m_frameSize, &reduced[i * m_frameSize]);
+    }
+    m_wavData.swap(reduced);
+    return rows - (int)keep.size();
+}
+
+// sum, sum of squares, min and max of one frame
+struct FrameStats_t {
+    double sum = 0.0;
+    double sumSquares = 0.0;
+    float minValue = 0.0f;
+    float maxValue = 0.0f;
 };
 
-bool WaveTableWriter::GetDataFromImageFile(const std::string& imagePath)
+// Accumulates into 8 lanes (lane = index % 8) of doubles and reduces the lanes
+// in a fixed order, both with and without AVX2, so the statistics (and the
+// levels derived from them) are bit identical whichever path was compiled.
+static FrameStats_t ComputeFrameStats(const float* frame, int count)
 {
-    imageManager im(m_frameSize, m_tableRows);
+    double sums[8] = {}, squares[8] = {};
+    float minValue = count > 0 ? frame[0] : 0.0f;
+    float maxValue = minValue;
+    int i = 0;
+#if defined(__AVX2__)
+    __m256d sumLo = _mm256_setzero_pd(), sumHi = _mm256_setzero_pd();
+    __m256d sqLo = _mm256_setzero_pd(), sqHi = _mm256_setzero_pd();
+    __m256 vMin = _mm256_set1_ps(minValue), vMax = _mm256_set1_ps(maxValue);
+    for (; i + 8 <= count; i += 8) {
+        __m256 v = _mm256_loadu_ps(frame + i);
+        __m256d lo = _mm256_cvtps_pd(_mm256_castps256_ps128(v));
+        __m256d hi = _mm256_cvtps_pd(_mm256_extractf128_ps(v, 1));
+        sumLo = _mm256_add_pd(sumLo, lo);
+        sumHi = _mm256_add_pd(sumHi, hi);
+        sqLo = _mm256_add_pd(sqLo, _mm256_mul_pd(lo, lo));
+        sqHi = _mm256_add_pd(sqHi, _mm256_mul_pd(hi, hi));
+        vMin = _mm256_min_ps(vMin, v);
+        vMax = _mm256_max_ps(vMax, v);
+    }
+    _mm256_storeu_pd(sums, sumLo);
+    _mm256_storeu_pd(sums + 4, sumHi);
+    _mm256_storeu_pd(squares, sqLo);
+    _mm256_storeu_pd(squares + 4, sqHi);
+    float lanes[8];
+    _mm256_storeu_ps(lanes, vMin);
+    minValue = *std::min_element(lanes, lanes + 8);
+    _mm256_storeu_ps(lanes, vMax);
+    maxValue = *std::max_element(lanes, lanes + 8);
+#endif
+    for (; i < count; ++i) {
+        double v = frame[i];
+        sums[i % 8] += v;
+        squares[i % 8] += v * v;
+        minValue = std::min(minValue, frame[i]);
+        maxValue = std::max(maxValue, frame[i]);
+    }
 
-    if (im.LoadFromFile(imagePath))
-    {
-        m_wavData = im.GetProcessedData();
-        m_dataReady = true;
-    } else {
-        std::cerr << "Image loader unable to process file: " << imagePath << std::endl;
-        return false;
+    FrameStats_t stats;
+    for (int lane = 0; lane < 8; ++lane) {
+        stats.sum += sums[lane];
+        stats.sumSquares += squares[lane];
     }
+    stats.minValue = minValue;
+    stats.maxValue = maxValue;
+    return stats;
+}
 
-    return true;
+// frame[i] = (frame[i] - offset) * gain
+static void OffsetAndScale(float* frame, int count, float offset, float gain)
+{
+    int i = 0;
+#if defined(__AVX2__)
+    const __m256 vOffset = _mm256_set1_ps(offset), vGain = _mm256_set1_ps(gain);
+    for (; i + 8 <= count; i += 8) {
+        __m256 v = _mm256_sub_ps(_mm256_loadu_ps(frame + i), vOffset);
+        _mm256_storeu_ps(frame + i, _mm256_mul_ps(v, vGain));
+    }
+#endif
+    for (; i < count; ++i) {
+        frame[i] = (frame[i] - offset) * gain;
+    }
 }
 
-bool WaveTableWriter::WriteWaveTableToFile(const std::string& filename, bool invert)
+// DC removal and peak/RMS normalization, per frame or across the table. One
+// statistics pass gathers everything (levels after DC removal are derived
+// from the sums), then one pass applies an offset and gain to every frame.
+bool WaveTableWriter::ConditionLevels(const LevelSettings_t& settings)
 {
     if (!m_dataReady) {
-        std::cerr << "Data is not ready for writing!" << std::endl;
+        std::cerr << "Data is not ready!" << std::endl;
         return false;
     }
+    if (settings.dc == DcMode::None && settings.normalize == NormalizeMode::None) {
+        return true;
+    }
 
-    // Create WAV header
-    WavHeader_t header;
-    header.numChannels = 1; // Mono
-    header.sampleRate = 48000;
-    header.bitsPerSample = 16;
-    header.blockAlign = header.numChannels * (header.bitsPerSample / 8);
-    header.byteRate = header.sampleRate * header.blockAlign;
-    header.dataSize = m_wavData.size() * sizeof(int16_t);
-    header.riffSize = 36 + header.dataSize; // 36 = size of header without RIFF chunk
+    const int rows = RowCount();
+    const double n = m_frameSize;
+    std::vector<FrameStats_t> stats(rows);
+    ParallelFor(rows, [&](int row) {
+        stats[row] = ComputeFrameStats(&m_wavData[(size_t)row * m_frameSize], m_frameSize);
+    });
 
-    // Write to WAV file
-    std::ofstream wavFile(filename, std::ios::binary);
-    if (!wavFile.is_open()) {
-        std::cerr << "Error opening WAV file: " << filename << std::endl;
-        return false;
-    }
-    
-    // Write header
-    wavFile.write(reinterpret_cast<const char*>(&header), sizeof(WavHeader_t));
-    
-    if (invert)
-    {
-        for (auto &x : m_wavData)
-        {
-            x = x * -1;
-        }
+    double tableSum = 0.0;
+    for (const auto& frame : stats) tableSum += frame.sum;
+    const double tableMean = tableSum / (n * std::max(rows, 1));
+
+    // offsets, then the peak and mean square each frame has once its offset is removed
+    std::vector<float> offsets(rows, 0.0f);
+    std::vector<double> peaks(rows), meanSquares(rows);
+    for (int row = 0; row < rows; ++row) {
+        double mean = stats[row].sum / n;
+        double offset = settings.dc == DcMode::Frame ? mean : settings.dc == DcMode::Table ? tableMean : 0.0;
+        offsets[row] = (float)offset;
+        peaks[row] = std::max(stats[row].maxValue - offset, offset - stats[row].minValue);
+        meanSquares[row] = std::max(0.0, stats[row].sumSquares / n - 2.0 * offset * mean + offset * offset);
     }
 
-    // Write audio data
-    wavFile.write(reinterpret_cast<const char*>(m_wavData.data()), m_wavData.size() * sizeof(int16_t));
-    
-    wavFile.close();
+    const bool rms = settings.normalize == NormalizeMode::RmsFrame || settings.normalize == NormalizeMode::RmsTable;
+    const bool perFrame = settings.normalize == NormalizeMode::PeakFrame || settings.normalize == NormalizeMode::RmsFrame;
+    const double target = settings.target > 0.0f ? settings.target : (rms ? 0.25 : 1.0);
+    double tableLevel = 0.0;
+    for (int row = 0; row < rows; ++row) {
+        tableLevel = rms ? tableLevel + meanSquares[row] : std::max(tableLevel, peaks[row]);
+    }
+    if (rms) tableLevel = std::sqrt(tableLevel / std::max(rows, 1));
 
-    // get the real row size (could have been reduced on trimming)
-    int actualRows = m_wavData.size() / m_frameSize;
-    std::cout << "Created WAV file with " << actualRows << " rows of " 
-              << m_frameSize << " samples each" << std::endl;
+    std::vector<float> gains(rows, 1.0f);
+    if (settings.normalize != NormalizeMode::None) {
+        for (int row = 0; row < rows; ++row) {
+            double level = perFrame ? (rms ? std::sqrt(meanSquares[row]) : peaks[row]) : tableLevel;
+            // leave silent frames alone rather than blowing up the noise floor
+            if (level > 1e-6) gains[row] = (float)(target / level);
+        }
+    }
 
+    ParallelFor(rows, [&](int row) {
+        OffsetAndScale(&m_wavData[(size_t)row * m_frameSize], m_frameSize, offsets[row], gains[row]);
+    });
     return true;
 }
 
+// peak-to-peak range of a row in int16 steps, the unit the trim threshold is given in
+static int RowVariance(const float* row, int frameSize)
+{
+    auto minmax = std::minmax_element(row, row + frameSize);
+    return static_cast<int16_t>(*minmax.second * 32767.0f) - static_cast<int16_t>(*minmax.first * 32767.0f);
+}
+
 int WaveTableWriter::TrimData(uint16_t thresholdVariance)
 {
     if (!m_dataReady) {
         std::cerr << "Data is not ready!" << std::endl;
         return 0;
     }
-    std::vector<int16_t> filteredData;
+    std::vector<float> filteredData;
     int filterCounter = 0;
     // iterate through rows
-    for (int r = 0; r < m_tableRows; ++r)
+    for (int r = 0; r < RowCount(); ++r)
     {
-        std::vector<int16_t> rowSample;
-        // put one row into our sample vector so we can just use algorithm
-        // note: inefficient but with the data sizes we are dealing with almost irrelevent
-        for (int x = 0; x < m_frameSize; ++x)
-        {            
-            int index = (r * m_frameSize) + x;
-            rowSample.push_back(m_wavData[index]);
-        }
-        auto minmax = std::minmax_element(rowSample.begin(), rowSample.end());
-        int variance = (*minmax.second - *minmax.first);
-        if (variance > thresholdVariance) {
-            filteredData.insert(filteredData.end(), rowSample.begin(), rowSample.end());
+        const float* rowSample = &m_wavData[(size_t)r * m_frameSize];
+        if (RowVariance(rowSample, m_frameSize) > thresholdVariance) {
+            filteredData.insert(filteredData.end(), rowSample, rowSample + m_frameSize);
         } else {
             filterCounter++;
         }
@@ -247,6 +2824,39 @@ int WaveTableWriter::TrimData(uint16_t thresholdVariance)
     return filterCounter;
 }
 
+// Trims the rows of channel tables together: a row stays in every table if
+// any of them has more than thresholdVariance range there, so the tables stay
+// row aligned. Returns the number of rows removed.
+int WaveTableWriter::TrimLinked(std::vector<WaveTableWriter>& channels, uint16_t thresholdVariance)
+{
+    if (channels.empty()) return 0;
+    const int rows = channels[0].RowCount();
+    for (const WaveTableWriter& channel : channels) {
+        if (!channel.m_dataReady || channel.RowCount() != rows) {
+            std::cerr << "Channel tables differ in size, can't trim them together" << std::endl;
+            return 0;
+        }
+    }
+
+    std::vector<int> keep;
+    for (int r = 0; r < rows; ++r) {
+        bool interesting = std::any_of(channels.begin(), channels.end(), [&](const WaveTableWriter& channel) {
+            return RowVariance(&channel.m_wavData[(size_t)r * channel.m_frameSize], channel.m_frameSize) > thresholdVariance;
+        });
+        if (interesting) keep.push_back(r);
+    }
+    for (WaveTableWriter& channel : channels) {
+        std::vector<float> filteredData;
+        filteredData.reserve(keep.size() * channel.m_frameSize);
+        for (int r : keep) {
+            const float* rowSample = &channel.m_wavData[(size_t)r * channel.m_frameSize];
+            filteredData.insert(filteredData.end(), rowSample, rowSample + channel.m_frameSize);
+        }
+        channel.m_wavData.swap(filteredData);
+    }
+    return rows - (int)keep.size();
+}
+
 void WaveTableWriter::PrintRowMinMax(void)
 {
     if (!m_dataReady) {
@@ -255,35 +2865,563 @@ void WaveTableWriter::PrintRowMinMax(void)
     }
 
     // iterate through rows
-    for (int r = 0; r < m_tableRows; ++r)
+    for (int r = 0; r < RowCount(); ++r)
     {
-        std::vector<int16_t> rowSample;
-        // put one row into our sample vector so we can just use algorithm
-        // note: inefficient but with the data sizes we are dealing with almost irrelevent
-        for (int x = 0; x < m_frameSize; ++x)
-        {            
-            int index = (r * m_frameSize) + x;
-            rowSample.push_back(m_wavData[index]);
+        const float* rowSample = &m_wavData[(size_t)r * m_frameSize];
+        auto minmax = std::minmax_element(rowSample, rowSample + m_frameSize);
+        cout << "Row# " << r << " min: " << static_cast<int16_t>(*minmax.first * 32767.0f)
+            << " max: " << static_cast<int16_t>(*minmax.second * 32767.0f)
+            << " variance " << RowVariance(rowSample, m_frameSize) << std::endl;
+    }
+}
+
+// parse a comma separated geometry list like "1024x256,512x256"
+static bool ParseGeometryList(const std::string& text, std::vector<RenderParams_t>& paramSets)
+{
+    size_t start = 0;
+    while (start <= text.size()) {
+        size_t end = text.find(',', start);
+        if (end == std::string::npos) end = text.size();
+        RenderParams_t params;
+        if (sscanf(text.substr(start, end - start).c_str(), "%dx%d", &params.frameSize, &params.tableRows) != 2
+            || params.frameSize <= 0 || params.tableRows <= 0) {
+            std::cerr << "Bad geometry (expected WIDTHxROWS): " << text.substr(start, end - start) << std::endl;
+            return false;
+        }
+        bool duplicate = std::any_of(paramSets.begin(), paramSets.end(), [&](const RenderParams_t& p) {
+            return p.frameSize == params.frameSize && p.tableRows == params.tableRows;
+        });
+        if (!duplicate) paramSets.push_back(params); // each size maps to one output file
+        start = end + 1;
+    }
+    return true;
+}
+
+// command line options; the defaults reproduce the original fixed behaviour
+struct Options_t {
+    std::string imagePath = "image.jpg";
+    std::string outputPath = "wavetable.wav";
+    std::string invertedPath;       // empty = derived from outputPath
+    bool writeInverted = true;
+    LoadSettings_t load;
+    SampleFormat sampleFormat = SampleFormat::Int16;
+    DitherSettings_t dither;
+    uint16_t trimThreshold = 16384; // trim boring rows (less than 1/4 AM range)
+    int mipmapOctaves = 0;
+    SpectralSettings_t spectral;
+    AlignMode align = AlignMode::None;
+    LevelSettings_t levels;
+    ResizeSettings_t resize;
+    int loopCrossfade = 0;
+    bool reorder = false;
+    int reduceFrames = 0;
+    int dedupeTolerance = 0;
+    std::vector<ChannelMix_t> channelMixes; // empty = one luma table
+    bool interleaveChannels = false;        // channelMixes become the channels of one WAV
+    int tileColumns = 0;                    // cut the image into a grid of tables, 0 = off
+    int tileRows = 0;
+    std::vector<RenderParams_t> geometries;
+    bool rowsGiven = false;                 // -r or -g set the table rows
+};
+
+// a channel mix like "r", "luma" or "0.5r+0.5a"
+static bool ParseChannelMix(const std::string& text, ChannelMix_t& mix)
+{
+    mix.name = text;
+    size_t start = 0;
+    while (start <= text.size()) {
+        size_t end = text.find('+', start);
+        if (end == std::string::npos) end = text.size();
+        std::string term = text.substr(start, end - start);
+        char* name = nullptr;
+        float weight = strtof(term.c_str(), &name);
+        if (name == term.c_str()) weight = 1.0f; // no factor
+        std::string channel = name;
+        if (channel == "r") mix.weights[0] += weight;
+        else if (channel == "g") mix.weights[1] += weight;
+        else if (channel == "b") mix.weights[2] += weight;
+        else if (channel == "a") mix.weights[3] += weight;
+        else if (channel == "luma") {
+            mix.weights[0] += weight * 0.2989f;
+            mix.weights[1] += weight * 0.587f;
+            mix.weights[2] += weight * 0.114f;
+        } else {
+            std::cerr << "Bad channel mix (expected r, g, b, a, luma or sums like 0.5r+0.5b): " << text << std::endl;
+            return false;
+        }
+        start = end + 1;
+    }
+    return true;
+}
+
+// comma separated channel mixes, duplicates are dropped
+static bool ParseChannelList(const std::string& text, std::vector<ChannelMix_t>& mixes)
+{
+    size_t start = 0;
+    while (start <= text.size()) {
+        size_t end = text.find(',', start);
+        if (end == std::string::npos) end = text.size();
+        ChannelMix_t mix;
+        if (!ParseChannelMix(text.substr(start, end - start), mix)) return false;
+        bool duplicate = std::any_of(mixes.begin(), mixes.end(), [&](const ChannelMix_t& m) {
+            return m.name == mix.name;
+        });
+        if (!duplicate) mixes.push_back(mix);
+        start = end + 1;
+    }
+    return true;
+}
+
+static void PrintUsage(const char* program)
+{
+    cout << "Usage: " << program << " [options] [image]\n"
+         << "  -i, --input PATH        image to convert (default image.jpg)\n"
+         << "  -o, --output PATH       wavetable to write (default wavetable.wav)\n"
+         << "      --inverted PATH     inverted wavetable to write (default <output>_inverted.wav)\n"
+         << "      --no-inverted       don't write the inverted wavetable\n"
+         << "  -f, --frame-size N      samples per frame (default 1024)\n"
+         << "  -r, --rows N            frames in the table (default 256)\n"
+         << "  -g, --geometry WxH,...  several table sizes from one decode, written as <output>_WxH.wav\n"
+         << "  -c, --channels LIST     a table per channel or mix from one decode, e.g. r,g,b,a or luma,0.5r+0.5b,\n"
+         << "                          written as <output>_<channel>.wav\n"
+         << "      --wav-channels LIST one multichannel WAV with these channels, e.g. r,b for R left / B right\n"
+         << "  -t, --threshold N       trim rows with a smaller peak-to-peak range (default 16384, 0 = off)\n"
+         << "      --format F          output sample format: int16 (default), int24 or float32\n"
+         << "      --dither MODE       int quantization: truncate (default), round, tpdf or shaped\n"
+         << "      --seed N            dither / random phase / k-means seed (default 0)\n"
+         << "      --mipmaps N         also write N band-limited octaves as <output>_oct1.wav ... _octN.wav\n"
+         << "      --spectral PHASE    read rows as harmonic spectra; PHASE is zero, schroeder or random\n"
+         << "      --align MODE        shift frames into phase: correlation or zero-crossing\n"
+         << "      --dc MODE           remove DC offset per frame or across the table: frame or table\n"
+         << "      --normalize MODE    peak-frame, peak-table, rms-frame or rms-table\n"
+         << "      --level X           normalization target (default 1.0 peak, 0.25 RMS)\n"
+         << "      --fixed-point       integer luma and a lookup table for the pixel conversion (within 1/255 of the float path)\n"
+         << "      --linear-light      resize and compute luma in linear light (sRGB decoded by table)\n"
+         << "      --float-resize      resize to float pixels instead of 8-bit ones (smoother 24-bit / float output)\n"
+         << "      --crop WxH+X+Y      only use this region of the image\n"
+         << "      --gif MODE          animated GIFs: frames (a table per frame) or rows (a row per frame; the\n"
+         << "                          table has as many rows as frames unless -r is given, more need --interpolate)\n"
+         << "      --frame-step MS     sample the animation every MS milliseconds instead of taking every frame\n"
+         << "      --tiles CxR         cut the image (or crop) into C x R tiles, a table each, as <output>_tile<row>_<col>.wav\n"
+         << "      --wrap-resize       resample rows as cyclic (filter wraps around the left/right edges)\n"
+         << "      --loop-fade N       blend N samples either side of each frame's loop point\n"
+         << "      --interpolate MODE  accept images shorter than the table, filling frames: linear or spectral\n"
+         << "      --dedupe N          drop frames within N int16 steps RMS of an earlier kept frame\n"
+         << "      --reduce K          cluster the frames (e.g. from a large --rows) down to K with k-means\n"
+         << "      --reorder           reorder frames so neighbours are as similar as possible\n"
+         << "      --luma-first        convert to luma before resizing (faster, slightly different rounding)\n"
+         << "      --background RRGGBB composite transparent images over this colour and drop alpha\n"
+         << "  -h, --help              show this help\n";
+}
+
+static bool ParseInt(const char* text, int minValue, int maxValue, int& value)
+{
+    char* end = nullptr;
+    long parsed = strtol(text, &end, 10);
+    if (!end || *end != '\0' || end == text || parsed < minValue || parsed > maxValue) {
+        std::cerr << "Bad numeric value: " << text << std::endl;
+        return false;
+    }
+    value = (int)parsed;
+    return true;
+}
+
+static bool ParseFloat(const char* text, float minValue, float maxValue, float& value)
+{
+    char* end = nullptr;
+    float parsed = strtof(text, &end);
+    if (!end || *end != '\0' || end == text || !(parsed >= minValue && parsed <= maxValue)) {
+        std::cerr << "Bad numeric value: " << text << std::endl;
+        return false;
+    }
+    value = parsed;
+    return true;
+}
+
+// returns false (after printing why) if the program should exit
+static bool ParseArguments(int argc, char *argv[], Options_t& options, int& exitCode)
+{
+    int frameSize = 1024; // maximum table that Ableton will accept for user data
+    int tableRows = 256;
+    int threshold = options.trimThreshold;
+    exitCode = 1;
+
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "-h" || arg == "--help") {
+            PrintUsage(argv[0]);
+            exitCode = 0;
+            return false;
+        } else if ((arg == "-i" || arg == "--input") && hasValue) {
+            options.imagePath = argv[++i];
+        } else if ((arg == "-o" || arg == "--output") && hasValue) {
+            options.outputPath = argv[++i];
+        } else if (arg == "--inverted" && hasValue) {
+            options.invertedPath = argv[++i];
+        } else if (arg == "--no-inverted") {
+            options.writeInverted = false;
+        } else if ((arg == "-f" || arg == "--frame-size") && hasValue) {
+            if (!ParseInt(argv[++i], 1, 1 << 20, frameSize)) return false;
+        } else if ((arg == "-r" || arg == "--rows") && hasValue) {
+            if (!ParseInt(argv[++i], 1, 1 << 16, tableRows)) return false;
+            options.rowsGiven = true;
+        } else if ((arg == "-g" || arg == "--geometry") && hasValue) {
+            if (!ParseGeometryList(argv[++i], options.geometries)) return false;
+            options.rowsGiven = true;
+        } else if ((arg == "-c" || arg == "--channels") && hasValue) {
+            if (!ParseChannelList(argv[++i], options.channelMixes)) return false;
+        } else if (arg == "--wav-channels" && hasValue) {
+            if (!ParseChannelList(argv[++i], options.channelMixes)) return false;
+            options.interleaveChannels = true;
+        } else if ((arg == "-t" || arg == "--threshold") && hasValue) {
+            if (!ParseInt(argv[++i], 0, 65535, threshold)) return false;
+        } else if (arg == "--format" && hasValue) {
+            std::string format = argv[++i];
+            if (format == "int16") options.sampleFormat = SampleFormat::Int16;
+            else if (format == "int24") options.sampleFormat = SampleFormat::Int24;
+            else if (format == "float32") options.sampleFormat = SampleFormat::Float32;
+            else {
+                std::cerr << "Unknown sample format: " << format << std::endl;
+                return false;
+            }
+        } else if (arg == "--dither" && hasValue) {
+            std::string mode = argv[++i];
+            if (mode == "truncate") options.dither.mode = DitherMode::Truncate;
+            else if (mode == "round") options.dither.mode = DitherMode::Round;
+            else if (mode == "tpdf") options.dither.mode = DitherMode::Tpdf;
+            else if (mode == "shaped") options.dither.mode = DitherMode::NoiseShaped;
+            else {
+                std::cerr << "Unknown dither mode: " << mode << std::endl;
+                return false;
+            }
+        } else if (arg == "--seed" && hasValue) {
+            int seed = 0;
+            if (!ParseInt(argv[++i], 0, 0x7FFFFFFF, seed)) return false;
+            options.dither.seed = (uint32_t)seed;
+        } else if (arg == "--mipmaps" && hasValue) {
+            if (!ParseInt(argv[++i], 0, 30, options.mipmapOctaves)) return false;
+        } else if (arg == "--spectral" && hasValue) {
+            std::string phase = argv[++i];
+            options.spectral.enabled = true;
+            if (phase == "zero") options.spectral.phase = SpectralPhase::Zero;
+            else if (phase == "schroeder") options.spectral.phase = SpectralPhase::Schroeder;
+            else if (phase == "random") options.spectral.phase = SpectralPhase::Random;
+            else {
+                std::cerr << "Unknown spectral phase: " << phase << std::endl;
+                return false;
+            }
+        } else if (arg == "--align" && hasValue) {
+            std::string mode = argv[++i];
+            if (mode == "correlation") options.align = AlignMode::CrossCorrelation;
+            else if (mode == "zero-crossing") options.align = AlignMode::ZeroCrossing;
+            else {
+                std::cerr << "Unknown align mode: " << mode << std::endl;
+                return false;
+            }
+        } else if (arg == "--dc" && hasValue) {
+            std::string mode = argv[++i];
+            if (mode == "frame") options.levels.dc = DcMode::Frame;
+            else if (mode == "table") options.levels.dc = DcMode::Table;
+            else {
+                std::cerr << "Unknown DC mode: " << mode << std::endl;
+                return false;
+            }
+        } else if (arg == "--normalize" && hasValue) {
+            std::string mode = argv[++i];
+            if (mode == "peak-frame") options.levels.normalize = NormalizeMode::PeakFrame;
+            else if (mode == "peak-table") options.levels.normalize = NormalizeMode::PeakTable;
+            else if (mode == "rms-frame") options.levels.normalize = NormalizeMode::RmsFrame;
+            else if (mode == "rms-table") options.levels.normalize = NormalizeMode::RmsTable;
+            else {
+                std::cerr << "Unknown normalize mode: " << mode << std::endl;
+                return false;
+            }
+        } else if (arg == "--level" && hasValue) {
+            if (!ParseFloat(argv[++i], 0.0f, 1.0f, options.levels.target)) return false;
+        } else if (arg == "--fixed-point") {
+            options.resize.fixedPointLuma = true;
+        } else if (arg == "--linear-light") {
+            options.resize.linearLight = true;
+        } else if (arg == "--float-resize") {
+            options.resize.floatOutput = true;
+        } else if (arg == "--crop" && hasValue) {
+            CropRect_t& crop = options.resize.crop;
+            char end = 0;
+            if (sscanf(argv[++i], "%dx%d+%d+%d%c", &crop.width, &crop.height, &crop.x, &crop.y, &end) != 4
+                || crop.Empty() || crop.x < 0 || crop.y < 0) {
+                std::cerr << "Bad crop region (expected WxH+X+Y): " << argv[i] << std::endl;
+                return false;
+            }
+        } else if (arg == "--gif" && hasValue) {
+            std::string mode = argv[++i];
+            if (mode == "frames") options.load.animation = AnimationMode::Frames;
+            else if (mode == "rows") options.load.animation = AnimationMode::Rows;
+            else {
+                std::cerr << "Unknown GIF mode: " << mode << std::endl;
+                return false;
+            }
+        } else if (arg == "--frame-step" && hasValue) {
+            if (!ParseInt(argv[++i], 0, 1 << 24, options.load.frameStepMs)) return false;
+        } else if (arg == "--tiles" && hasValue) {
+            char end = 0;
+            if (sscanf(argv[++i], "%dx%d%c", &options.tileColumns, &options.tileRows, &end) != 2
+                || options.tileColumns <= 0 || options.tileRows <= 0) {
+                std::cerr << "Bad tile grid (expected COLUMNSxROWS): " << argv[i] << std::endl;
+                return false;
+            }
+        } else if (arg == "--wrap-resize") {
+            options.resize.wrapEdges = true;
+        } else if (arg == "--loop-fade" && hasValue) {
+            if (!ParseInt(argv[++i], 0, 1 << 20, options.loopCrossfade)) return false;
+        } else if (arg == "--interpolate" && hasValue) {
+            std::string mode = argv[++i];
+            if (mode == "linear") options.resize.interpolation = FrameInterpolation::Linear;
+            else if (mode == "spectral") options.resize.interpolation = FrameInterpolation::Spectral;
+            else {
+                std::cerr << "Unknown interpolation mode: " << mode << std::endl;
+                return false;
+            }
+        } else if (arg == "--dedupe" && hasValue) {
+            if (!ParseInt(argv[++i], 0, 65535, options.dedupeTolerance)) return false;
+        } else if (arg == "--reduce" && hasValue) {
+            if (!ParseInt(argv[++i], 0, 1 << 16, options.reduceFrames)) return false;
+        } else if (arg == "--reorder") {
+            options.reorder = true;
+        } else if (arg == "--luma-first") {
+            options.load.convertToLuma = true;
+        } else if (arg == "--background" && hasValue) {
+            unsigned int rgb = 0;
+            const char* text = argv[++i];
+            if (text[0] == '#') text++;
+            if (strlen(text) != 6 || sscanf(text, "%6x", &rgb) != 1 || strspn(text, "0123456789abcdefABCDEF") != 6) {
+                std::cerr << "Bad background colour (expected RRGGBB): " << argv[i] << std::endl;
+                return false;
+            }
+            options.load.composite = true;
+            options.load.background[0] = (unsigned char)(rgb >> 16);
+            options.load.background[1] = (unsigned char)(rgb >> 8);
+            options.load.background[2] = (unsigned char)rgb;
+        } else if (arg.size() > 1 && arg[0] == '-') {
+            std::cerr << "Unknown or incomplete option: " << arg << std::endl;
+            PrintUsage(argv[0]);
+            return false;
+        } else {
+            options.imagePath = arg;
         }
-        auto minmax = std::minmax_element(rowSample.begin(), rowSample.end());
-        cout << "Row# " << r << " min: " << *minmax.first << " max: " << *minmax.second 
-            << " variance " << (*minmax.second - *minmax.first) << std::endl;
     }
+
+    if (options.interleaveChannels && (options.dedupeTolerance > 0 || options.reduceFrames > 0 || options.reorder)) {
+        std::cerr << "--wav-channels keeps the channels row aligned, it can't be combined with --dedupe, --reduce or --reorder" << std::endl;
+        return false;
+    }
+    if (!options.channelMixes.empty() && options.load.convertToLuma) {
+        std::cerr << "--channels needs the colour image, it can't be combined with --luma-first" << std::endl;
+        return false;
+    }
+    if (options.geometries.empty()) {
+        RenderParams_t params;
+        params.frameSize = frameSize;
+        params.tableRows = tableRows;
+        options.geometries.push_back(params);
+    }
+    options.trimThreshold = (uint16_t)threshold;
+    options.spectral.seed = options.dither.seed;
+    for (auto& params : options.geometries) {
+        params.trimThreshold = options.trimThreshold;
+        params.spectral = options.spectral;
+        params.align = options.align;
+        params.levels = options.levels;
+        params.resize = options.resize;
+        params.loopCrossfade = options.loopCrossfade;
+        params.reorder = options.reorder;
+        params.reduceFrames = options.reduceFrames;
+        params.dedupeTolerance = options.dedupeTolerance;
+        params.seed = options.dither.seed;
+    }
+    return true;
+}
+
+// "dir/name.wav" + "_x" -> "dir/name_x.wav"
+static std::string AddFileSuffix(const std::string& path, const std::string& suffix)
+{
+    size_t dot = path.find_last_of('.');
+    size_t slash = path.find_last_of("/\\");
+    if (dot == std::string::npos || (slash != std::string::npos && dot < slash)) {
+        return path + suffix;
+    }
+    return path.substr(0, dot) + suffix + path.substr(dot);
 }
 
 int main(int argc, char *argv[])
 {    
-    std::string imagePath = "image.jpg";
-    std::string wavetablePath = "wavetable.wav";
-    std::string wavetablePathInv = "wavetable_inverted.wav";
-
-    WaveTableWriter wt(1024, 256); // maximum table that Ableton will accept for user data
-    wt.GetDataFromImageFile(imagePath);
-    //wt.PrintRowMinMax();
-    // trim boring rows (less than 1/4 AM range)
-    cout << "Trimmed " << wt.TrimData(16384) << " rows.\n";
-    wt.WriteWaveTableToFile(wavetablePath, false);
-    wt.WriteWaveTableToFile(wavetablePathInv, true);
-
-    return 0;
+    Options_t options;
+    int exitCode = 0;
+    if (!ParseArguments(argc, argv, options, exitCode)) return exitCode;
+
+    ImageSession session;
+    options.load.linearLight = options.resize.linearLight;
+    if (!session.Open(options.imagePath, options.load)) return 1;
+
+    // --gif rows: without -r the table gets a row per selected frame; a larger
+    // table can only be filled by interpolating between the frames
+    if (session.AnimationRows() > 0) {
+        const int frameRows = session.AnimationRows();
+        for (auto& params : options.geometries) {
+            if (!options.rowsGiven) params.tableRows = frameRows;
+            if (params.tableRows > frameRows && params.resize.interpolation == FrameInterpolation::None) {
+                std::cerr << "The animation has " << frameRows << " frames, fewer than the " << params.tableRows
+                          << " table rows: use -r " << frameRows << " or less, or --interpolate" << std::endl;
+                return 1;
+            }
+        }
+    }
+
+    // a single geometry writes exactly the requested file names; several are
+    // rendered from one resize pyramid and get a _WxH suffix each. Channel
+    // tables add a _<channel> suffix, unless they are interleaved into one
+    // multichannel file (an output with several tables). Animation frames add
+    // _frame<n>, tiles _tile<row>_<column>.
+    const auto& geometries = options.geometries;
+    bool multiple = geometries.size() > 1;
+    auto geometrySuffix = [&](const RenderParams_t& params) {
+        return multiple ? "_" + std::to_string(params.frameSize) + "x" + std::to_string(params.tableRows) : std::string();
+    };
+    typedef std::vector<std::vector<WaveTableWriter>> Outputs_t;
+    auto renderChannels = [&](const RenderParams_t& params, const std::string& suffix,
+                              Outputs_t& outputs, std::vector<std::string>& suffixes) {
+        std::vector<WaveTableWriter> channels = session.RenderChannels(params, options.channelMixes, options.interleaveChannels);
+        if (options.interleaveChannels) {
+            outputs.push_back(std::move(channels));
+            suffixes.push_back(suffix);
+            return;
+        }
+        for (size_t c = 0; c < channels.size(); ++c) {
+            outputs.push_back({std::move(channels[c])});
+            suffixes.push_back(suffix + "_" + options.channelMixes[c].name);
+        }
+    };
+
+    auto write = [](const std::vector<WaveTableWriter>& tables, const std::string& path, bool invert) {
+        return tables.size() == 1 ? tables[0].WriteWaveTableToFile(path, invert)
+                                  : WaveTableWriter::WriteMultiChannelFile(tables, path, invert);
+    };
+    auto writeOutput = [&](std::vector<WaveTableWriter>& tables, const std::string& suffix) {
+        if (std::any_of(tables.begin(), tables.end(), [](const WaveTableWriter& t) { return !t.DataReady(); })) {
+            return false;
+        }
+        std::string path = AddFileSuffix(options.outputPath, suffix);
+        std::string invertedPath = options.invertedPath.empty() ? AddFileSuffix(path, "_inverted")
+                                                                : AddFileSuffix(options.invertedPath, suffix);
+        //tables[0].PrintRowMinMax();
+        for (WaveTableWriter& table : tables) {
+            table.SetSampleFormat(options.sampleFormat);
+            table.SetDither(options.dither);
+        }
+        bool ok = write(tables, path, false);
+        if (options.writeInverted && !write(tables, invertedPath, true)) ok = false;
+
+        std::vector<std::vector<WaveTableWriter>> mipmaps;
+        for (const WaveTableWriter& table : tables) {
+            std::vector<WaveTableWriter> octaves = table.BuildMipmaps(options.mipmapOctaves);
+            mipmaps.resize(octaves.size());
+            for (size_t octave = 0; octave < octaves.size(); ++octave) mipmaps[octave].push_back(std::move(octaves[octave]));
+        }
+        for (size_t octave = 0; octave < mipmaps.size(); ++octave) {
+            std::string octaveSuffix = "_oct" + std::to_string(octave + 1);
+            if (!write(mipmaps[octave], AddFileSuffix(path, octaveSuffix), false)) ok = false;
+            if (options.writeInverted && !write(mipmaps[octave], AddFileSuffix(invertedPath, octaveSuffix), true)) ok = false;
+        }
+        return ok;
+    };
+
+    // Animation frames (in frames mode) and tiles are regions of the one
+    // decoded image: every frame of the stack, or the crop within each frame,
+    // split into the tile grid. Each region is resampled as an image of its own.
+    struct Region_t {
+        CropRect_t crop;
+        std::string suffix;
+    };
+    std::vector<Region_t> regions;
+    const imageManager& image = session.Image();
+    const bool frameTables = options.load.animation == AnimationMode::Frames;
+    if (frameTables || options.tileColumns > 0) {
+        const CropRect_t& userCrop = options.resize.crop;
+        if (!userCrop.Empty() && userCrop.y + userCrop.height > image.FrameHeight()) {
+            std::cerr << "Crop region is outside the " << image.Width() << "x" << image.FrameHeight() << " frame" << std::endl;
+            return 1;
+        }
+        std::vector<int> frames = frameTables ? image.SelectFrames(options.load.frameStepMs) : std::vector<int>{0};
+        const int columns = std::max(options.tileColumns, 1);
+        const int rows = std::max(options.tileRows, 1);
+        for (size_t f = 0; f < frames.size(); ++f) {
+            CropRect_t area = userCrop;
+            if (area.Empty()) {
+                area.width = image.Width();
+                area.height = image.FrameHeight();
+            }
+            area.y += frames[f] * image.FrameHeight();
+            std::string frameSuffix = frameTables ? "_frame" + std::to_string(f) : "";
+            for (int row = 0; row < rows; ++row) {
+                for (int column = 0; column < columns; ++column) {
+                    Region_t region;
+                    region.crop.x = area.x + (int)((int64_t)area.width * column / columns);
+                    region.crop.y = area.y + (int)((int64_t)area.height * row / rows);
+                    region.crop.width = area.x + (int)((int64_t)area.width * (column + 1) / columns) - region.crop.x;
+                    region.crop.height = area.y + (int)((int64_t)area.height * (row + 1) / rows) - region.crop.y;
+                    // frames are stacked and tiles may be unrelated images (an atlas),
+                    // so the filter must not read the neighbouring frame or tile
+                    region.crop.isolated = true;
+                    region.suffix = frameSuffix;
+                    if (options.tileColumns > 0) region.suffix += "_tile" + std::to_string(row) + "_" + std::to_string(column);
+                    regions.push_back(region);
+                }
+            }
+        }
+    }
+
+    std::atomic<bool> failed(false);
+    if (!regions.empty()) {
+        // A task renders a region and writes it straight away, so only the
+        // tables in flight are held in memory.
+        const int regionCount = (int)regions.size();
+        ParallelFor(regionCount * (int)geometries.size(), [&](int job) {
+            const Region_t& region = regions[job % regionCount];
+            RenderParams_t params = geometries[job / regionCount];
+            params.resize.crop = region.crop;
+            std::string suffix = geometrySuffix(params) + region.suffix;
+
+            Outputs_t outputs;
+            std::vector<std::string> suffixes;
+            if (options.channelMixes.empty()) {
+                outputs.push_back({session.Render(params)});
+                suffixes.push_back(suffix);
+            } else {
+                renderChannels(params, suffix, outputs, suffixes);
+            }
+            for (size_t i = 0; i < outputs.size(); ++i) {
+                if (!writeOutput(outputs[i], suffixes[i])) failed = true;
+            }
+        });
+        return failed ? 1 : 0;
+    }
+
+    Outputs_t outputs;
+    std::vector<std::string> suffixes;
+    if (options.channelMixes.empty()) {
+        std::vector<WaveTableWriter> writers = multiple ? session.RenderPyramid(geometries)
+                                                        : std::vector<WaveTableWriter>{session.Render(geometries[0])};
+        for (size_t g = 0; g < writers.size(); ++g) {
+            outputs.push_back({std::move(writers[g])});
+            suffixes.push_back(geometrySuffix(geometries[g]));
+        }
+    } else {
+        for (const RenderParams_t& params : geometries) renderChannels(params, geometrySuffix(params), outputs, suffixes);
+    }
+
+    ParallelFor((int)outputs.size(), [&](int i) {
+        if (!writeOutput(outputs[i], suffixes[i])) failed = true;
+    });
+
+    return failed ? 1 : 0;
 }
\ No newline at end of file